@@ -0,0 +1,385 @@
+// Microbenchmarks of the generation engine, built and run by 'make bench'.
+// The benchmark is compiled together with the library source so that it can
+// time the internals of a stream directly. Every case is timed over batches
+// of repeated calls and the median of the batches is reported. The results
+// are written as JSON to track regressions across releases
+
+// opens the stream to the benchmark
+#define CEA_BENCH
+#include "cea.cpp"
+#include <regex>
+
+// duration of a batch the repetitions are calibrated to
+#define CEA_BENCH_BATCH_NS 20000000
+
+// batches timed per case, the median is reported
+#define CEA_BENCH_SAMPLES 7
+
+namespace cea {
+
+class cea_bench {
+public:
+    void field_write();
+    void mutate_next_frame();
+    void payload_fill();
+    void splice_frame_fields();
+    void bootstrap();
+    void pcap_write();
+    void mutate_enqueue();
+    void parse();
+    void write_json(string fname);
+
+private:
+    struct result {
+        string name;
+        vector<pair<string, string>> params;
+        uint64_t ops;
+        double ns_per_op;
+    };
+    vector<result> results;
+
+    // time a case, f runs one repetition and returns the number of operations
+    // it did. max_reps bounds the repetitions of the cases that allocate
+    template <typename F>
+    void run(string name, vector<pair<string, string>> params, F f,
+        uint32_t max_reps = UINT32_MAX, uint32_t samples = CEA_BENCH_SAMPLES);
+
+    cea_stream *make_stream(uint32_t frame_len);
+};
+
+template <typename F>
+void cea_bench::run(string name, vector<pair<string, string>> params, F f,
+    uint32_t max_reps, uint32_t samples) {
+    // warm up and calibrate
+    uint64_t t0 = timebase.now_ns();
+    f();
+    uint64_t once = max(timebase.now_ns() - t0, (uint64_t) 1);
+    uint32_t reps = min((uint64_t) max_reps, max((uint64_t) 1,
+        (uint64_t) CEA_BENCH_BATCH_NS / once));
+
+    vector<double> ns_per_op;
+    uint64_t total_ops = 0;
+    for (uint32_t n = 0; n < samples; n++) {
+        uint64_t ops = 0;
+        uint64_t start = timebase.now_ns();
+        for (uint32_t r = 0; r < reps; r++) {
+            ops += f();
+        }
+        uint64_t elapsed = timebase.now_ns() - start;
+        ns_per_op.push_back((double) elapsed / max(ops, (uint64_t) 1));
+        total_ops += ops;
+    }
+    sort(ns_per_op.begin(), ns_per_op.end());
+    result res = {name, params, total_ops, ns_per_op[ns_per_op.size() / 2]};
+    results.push_back(res);
+
+    stringstream ss;
+    ss << left << setw(20) << name;
+    for (auto &p : params) {
+        ss << " " << p.first << "=" << p.second;
+    }
+    fprintf(stderr, "%-60s %12.2f ns/op %14.0f op/s\n", ss.str().c_str(),
+        res.ns_per_op, 1e9 / res.ns_per_op);
+}
+
+// the streams under test carry a mac, an ipv4 and an udp header
+cea_stream *cea_bench::make_stream(uint32_t frame_len) {
+    cea_stream *s = new cea_stream("bench");
+    s->set(FRAME_Len, frame_len);
+    s->set(STREAM_Traffic_Type, Continuous);
+    s->add_header(new cea_header(MAC));
+    s->add_header(new cea_header(IPv4));
+    s->add_header(new cea_header(UDP));
+    return s;
+}
+
+//------------------------------------------------------------------------------
+// cases
+//------------------------------------------------------------------------------
+
+// write of a field value in network byte order, by field width
+void cea_bench::field_write() {
+    unsigned char buf[64];
+    for (uint32_t width : {1, 2, 4, 6, 8}) {
+        run("field_write", {{"width", to_string(width)}}, [&]() {
+            for (uint64_t value = 0; value < 100000; value++) {
+                cea_memcpy_ntw_byte_order(buf + (value & 31), &value, width);
+                asm volatile("" : : "r"(buf) : "memory");
+            }
+            return (uint64_t) 100000;
+        });
+    }
+}
+
+// mutation of the principal frame by generation type and number of fields
+void cea_bench::mutate_next_frame() {
+    vector<cea_field_id> fields = {IPv4_Id, IPv4_TTL, IPv4_Src_Addr,
+        IPv4_Dest_Addr};
+    vector<cea_gen_type> types = {Fixed_Value, Increment, Decrement,
+        Value_List, Random};
+    vector<string> type_names = {"Fixed_Value", "Increment", "Decrement",
+        "Value_List", "Random"};
+
+    for (uint32_t t = 0; t < types.size(); t++) {
+        for (uint32_t nof_fields : {1, 2, 4}) {
+            cea_stream *s = new cea_stream("bench");
+            s->set(FRAME_Len, 128);
+            cea_header *ip = new cea_header(IPv4);
+            for (uint32_t f = 0; f < nof_fields; f++) {
+                cea_field_genspec spec = {};
+                spec.gen_type = types[t];
+                spec.nmr.value = 1;
+                spec.nmr.start = 1;
+                spec.nmr.step = 1;
+                spec.nmr.count = 1000;
+                spec.nmr.repeat = true;
+                spec.nmr.values = {1, 2, 3, 4, 5, 6, 7, 8};
+                ip->set(fields[f], spec);
+            }
+            s->add_header(new cea_header(MAC));
+            s->add_header(ip);
+            auto sc = s->impl.get();
+            sc->bootstrap_stream();
+            sc->prepare_for_mutation(CEA_IFWIDTH, CEA_LINE_RATE * 1000000UL);
+            run("mutate_next_frame", {{"gen_type", type_names[t]},
+                {"fields", to_string(nof_fields)}}, [&]() {
+                for (uint32_t n = 0; n < 10000; n++) {
+                    sc->mutate_next_frame();
+                }
+                return (uint64_t) 10000;
+            });
+            delete s;
+        }
+    }
+}
+
+// build of the payload arrays of a stream, by payload pattern. An operation
+// is one byte of the CEA_MAX_FRAME_SIZE payload
+void cea_bench::payload_fill() {
+    vector<cea_gen_type> types = {Fixed_Value, Increment_Byte, Increment_Word,
+        Decrement_Byte, Random};
+    vector<string> type_names = {"Fixed_Value", "Increment_Byte",
+        "Increment_Word", "Decrement_Byte", "Random"};
+
+    for (uint32_t t = 0; t < types.size(); t++) {
+        cea_stream *s = make_stream(1518);
+        cea_field_genspec spec = {};
+        spec.gen_type = types[t];
+        spec.str.value = "a5a5";
+        spec.str.repeat = true;
+        s->set(PAYLOAD_Pattern, spec);
+        auto sc = s->impl.get();
+        sc->bootstrap_stream();
+        // a random pattern fills CEA_MAX_RND_ARRAYS arrays of random data,
+        // it is timed once
+        bool rnd = (types[t] == Random);
+        run("payload_fill", {{"pattern", type_names[t]}}, [&]() {
+            sc->build_payload_arrays();
+            return (uint64_t) CEA_MAX_FRAME_SIZE;
+        }, rnd ? 1 : UINT32_MAX, rnd ? 1 : CEA_BENCH_SAMPLES);
+        delete s;
+    }
+}
+
+// build of the principal frame from the header fields
+void cea_bench::splice_frame_fields() {
+    cea_stream *s = make_stream(128);
+    auto sc = s->impl.get();
+    sc->bootstrap_stream();
+    unsigned char *buf = new unsigned char [CEA_MAX_FRAME_SIZE];
+    run("splice_frame_fields", {{"headers", "MAC+IPv4+UDP"},
+        {"fields", to_string(sc->frame_fields.size())}}, [&]() {
+        for (uint32_t n = 0; n < 1000; n++) {
+            sc->splice_frame_fields(buf, sc->frame_fields);
+            asm volatile("" : : "r"(buf) : "memory");
+        }
+        return (uint64_t) 1000;
+    });
+    delete [] buf;
+    delete s;
+}
+
+// creation and bootstrap of a stream up to its first frame
+void cea_bench::bootstrap() {
+    run("stream_bootstrap", {{"headers", "MAC+IPv4+UDP"}}, [&]() {
+        cea_stream *s = make_stream(128);
+        s->impl->bootstrap_stream();
+        s->impl->prepare_for_mutation(CEA_IFWIDTH, CEA_LINE_RATE * 1000000UL);
+        delete s;
+        return (uint64_t) 1;
+    }, 50);
+}
+
+// frames recorded per second including the drain of the writer thread. The
+// frames dropped by a writer that fell behind are reported with the result
+void cea_bench::pcap_write() {
+    unsigned char frame[CEA_MAX_FRAME_SIZE] = {};
+    for (uint32_t len : {64, 512, 1518}) {
+        uint64_t drops = 0;
+        run("pcap_write", {{"frame_len", to_string(len)}}, [&]() {
+            pcap *p = new pcap("bench.pcap", "bench", 0);
+            for (uint32_t n = 0; n < 100000; n++) {
+                p->write(frame, len, nullptr, 0);
+            }
+            p->close();
+            drops += p->drops.load();
+            delete p;
+            return (uint64_t) 100000;
+        }, 20);
+        results.back().params.push_back({"drops", to_string(drops)});
+    }
+    remove("bench.pcap");
+}
+
+// frames generated into a transmit ring, by frame size
+void cea_bench::mutate_enqueue() {
+    cea_txring ring;
+    ring.width = CEA_IFWIDTH;
+    ring.capacity = CEA_TXRING_SIZE / ring.width;
+    ring.base = (unsigned char*) aligned_alloc(CEA_CACHELINE, CEA_TXRING_SIZE);
+
+    for (uint32_t len : {64, 128, 512, 1518, 9000}) {
+        cea_stream *s = make_stream(len);
+        auto sc = s->impl.get();
+        sc->bootstrap_stream();
+        sc->prepare_for_mutation(ring.width, CEA_LINE_RATE * 1000000UL);
+        run("mutate_enqueue", {{"frame_len", to_string(len)}}, [&]() {
+            uint64_t frames = sc->stats.frames;
+            ring.count = 0;
+            sc->mutate_enqueue(ring, ring.capacity);
+            return sc->stats.frames - frames;
+        });
+        delete s;
+    }
+    free(ring.base);
+}
+
+// validation and conversion of 100k address strings, by address type. The
+// regex path is the validation and conversion the pattern fields used before
+// the single pass parsers, it is kept here as the reference
+void cea_bench::parse() {
+    regex regex_mac("([[:xdigit:]]{2}[:]?){5}[[:xdigit:]]{2}");
+    regex regex_ipv4("^(?:(?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9])[.]){3}(?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9])$");
+    regex regex_ipv6("((([0-9a-fA-F]){1,4})[:]){7}([0-9a-fA-F]){1,4}");
+
+    vector<string> macs, ipv4s, ipv6s;
+    mt19937_64 engine(1);
+    for (uint32_t n = 0; n < 100000; n++) {
+        uint64_t r = engine();
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+            (uint32_t) (r >> 40) & 0xff, (uint32_t) (r >> 32) & 0xff,
+            (uint32_t) (r >> 24) & 0xff, (uint32_t) (r >> 16) & 0xff,
+            (uint32_t) (r >> 8) & 0xff, (uint32_t) r & 0xff);
+        macs.push_back(buf);
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u",
+            (uint32_t) (r >> 24) & 0xff, (uint32_t) (r >> 16) & 0xff,
+            (uint32_t) (r >> 8) & 0xff, (uint32_t) r & 0xff);
+        ipv4s.push_back(buf);
+        // the regex accepts only the uncompressed notation
+        snprintf(buf, sizeof(buf), "2001:db8:%x:%x:%x:%x:%x:%x",
+            (uint32_t) (r >> 48) & 0xffff, (uint32_t) (r >> 32) & 0xffff,
+            (uint32_t) (r >> 16) & 0xffff, (uint32_t) r & 0xffff,
+            (uint32_t) (r >> 8) & 0xfff, (uint32_t) r & 0xfff);
+        ipv6s.push_back(buf);
+    }
+    cea_stream *s = new cea_stream("bench");
+    auto sc = s->impl.get();
+    uint64_t sink = 0;
+
+    run("parse", {{"type", "MAC"}, {"method", "regex"}}, [&]() {
+        for (auto &a : macs) {
+            if (regex_match(a, regex_mac)) {
+                string tmp = a;
+                tmp.erase(remove(tmp.begin(), tmp.end(), ':'), tmp.end());
+                sink += stoul(tmp, 0, 16);
+            }
+        }
+        return (uint64_t) macs.size();
+    }, 5, 3);
+    run("parse", {{"type", "MAC"}, {"method", "parser"}}, [&]() {
+        for (auto &a : macs) {
+            uint64_t mac;
+            if (cea_parse_mac(a, mac)) sink += mac;
+        }
+        return (uint64_t) macs.size();
+    });
+    run("parse", {{"type", "IPv4"}, {"method", "regex"}}, [&]() {
+        for (auto &a : ipv4s) {
+            if (regex_match(a, regex_ipv4)) {
+                stringstream ss, check(a);
+                string octet;
+                while (getline(check, octet, '.')) {
+                    ss << setfill('0') << setw(2) << hex << stoi(octet);
+                }
+                sink += stoul(ss.str(), 0, 16);
+            }
+        }
+        return (uint64_t) ipv4s.size();
+    }, 5, 3);
+    run("parse", {{"type", "IPv4"}, {"method", "parser"}}, [&]() {
+        for (auto &a : ipv4s) {
+            sink += sc->convert_string_ipv4_internal(a);
+        }
+        return (uint64_t) ipv4s.size();
+    });
+    run("parse", {{"type", "IPv6"}, {"method", "regex"}}, [&]() {
+        for (auto &a : ipv6s) {
+            sink += regex_match(a, regex_ipv6);
+        }
+        return (uint64_t) ipv6s.size();
+    }, 5, 3);
+    run("parse", {{"type", "IPv6"}, {"method", "parser"}}, [&]() {
+        for (auto &a : ipv6s) {
+            unsigned char addr[16];
+            if (cea_parse_ipv6(a, addr)) sink += addr[15];
+        }
+        return (uint64_t) ipv6s.size();
+    });
+    asm volatile("" : : "r"(sink));
+    delete s;
+}
+
+//------------------------------------------------------------------------------
+// report
+//------------------------------------------------------------------------------
+
+void cea_bench::write_json(string fname) {
+    ofstream out(fname);
+    out << "{\n";
+    out << "  \"timestamp\": " << timebase.now_ns() / 1000000000UL << ",\n";
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "  \"trace_level\": " << CEA_TRACE_LEVEL << ",\n";
+    out << "  \"results\": [\n";
+    for (uint32_t idx = 0; idx < results.size(); idx++) {
+        result &r = results[idx];
+        out << "    {\"name\": \"" << r.name << "\", \"params\": {";
+        for (uint32_t p = 0; p < r.params.size(); p++) {
+            out << (p ? ", " : "") << "\"" << r.params[p].first << "\": \""
+                << r.params[p].second << "\"";
+        }
+        out << "}, \"ops\": " << r.ops << fixed << setprecision(3)
+            << ", \"ns_per_op\": " << r.ns_per_op
+            << ", \"ops_per_sec\": " << 1e9 / r.ns_per_op << "}"
+            << (idx + 1 < results.size() ? "," : "") << "\n";
+        out << defaultfloat;
+    }
+    out << "  ]\n}\n";
+    fprintf(stderr, "Results written to %s\n", fname.c_str());
+}
+
+} // namespace cea
+
+int main(int argc, char **argv) {
+    cea::cea_bench bench;
+    bench.field_write();
+    bench.mutate_next_frame();
+    bench.payload_fill();
+    bench.splice_frame_fields();
+    bench.bootstrap();
+    bench.pcap_write();
+    bench.mutate_enqueue();
+    bench.parse();
+    bench.write_json(argc > 1 ? argv[1] : "bench.json");
+    return 0;
+}
@@ -29,23 +29,42 @@ Notes to improve performance
 */  
 
 #include <thread>
+#include <mutex>
 #include <iomanip>
 #include <algorithm>
 #include <cstring>
 #include <string>
 #include <map>
+#include <deque>
 #include <cmath>
 #include <fstream>
 #include <sstream>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
 #include <chrono>
 #include <cassert>
 #include <random>
 #include <csignal>
-#include <regex>
+#include <atomic>
+#include <functional>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 #include "cea.h"
 
 using namespace std;
@@ -68,24 +87,48 @@ using namespace chrono;
 #define CEA_RND_ARRAY_SIZE 1000000  // 1M
 #define CEA_PF_SIZE 1000000  // 1M
 
+// default width of the interface to the consumer in bytes
+#define CEA_IFWIDTH 64
+
+// cache line size used to align buffers shared with the consumer
+#define CEA_CACHELINE 64
+
+// size of the per port transmit staging ring in bytes (256KB)
+#define CEA_TXRING_SIZE 262144
+
+// default line rate of a port in Mbps
+#define CEA_LINE_RATE 10000
+
+// preamble and start of frame delimiter, occupies the line ahead of a frame
+#define CEA_PREAMBLE_LEN 8
+
+// smallest ipg in bytes the rate engine will generate
+#define CEA_MIN_IPG 12
+
+// bytes credited per round to the stream with the smallest share of a port
+// when its streams are interleaved
+#define CEA_DRR_QUANTUM 2048
+
 // CEA_MSG() - Used for mandatory messages inside classes.
 // Cannot be disabled in debug mode
 #define CEA_MSG(msg) { \
-    stringstream s; \
-    s << msg; cealog << "(" << msg_prefix << "|" << setw(8) << left \
-    << string(__FUNCTION__) << ")" << ": " <<  s.str() \
-    << endl; \
+    ostream &s = cea_log_begin(); \
+    s << "(" << msg_prefix << "|" << setw(8) << left << __FUNCTION__ \
+    << ")" << ": "; \
+    s << msg; \
+    cea_log_end(LOG_Info); \
 }
 
 // CEA_ERR_MSG() - Used for mandatory error messages inside classes.
-// Cannot be disabled in debug mode
+// Cannot be disabled in debug mode. The message is written out before the
+// macro returns since an abort() usually follows
 #define CEA_ERR_MSG(msg) { \
-    stringstream s; \
+    ostream &s = cea_log_begin(); \
+    s << "\n" << cea_formatted_hdr("Fatal Error"); \
+    s << "(" << msg_prefix << "|" << __FUNCTION__ << ")" << ": "; \
     s << msg; \
-    cealog << endl << cea_formatted_hdr("Fatal Error"); \
-    cealog << "(" << msg_prefix << "|" << string(__FUNCTION__) << ")" \
-    << ": " <<  s.str() << endl; \
-    cealog << string(CEA_FORMATTED_HDR_LEN, '-') << endl; \
+    s << "\n" << string(CEA_FORMATTED_HDR_LEN, '-'); \
+    cea_log_end(LOG_Error); \
 }
 
 // CEA_DBG() - Enabled only in debug mode
@@ -103,18 +146,18 @@ using namespace chrono;
 
 namespace cea {
 
-string msg_prefix = "cea";    
+// prefix of the messages logged outside of the classes, the port workers set
+// it to the name of their port
+thread_local string msg_prefix = "cea";
 
-// global variable to track proxy and stream id
-// TODO This will become a problem in multi-process mode
-uint32_t stream_id = 0;
-uint32_t port_id = 0;
+enum cea_log_level {
+    LOG_Info,
+    LOG_Error
+};
 
-// regex pattern to check user inputs
-regex regex_mac("([[:xdigit:]]{2}[:]?){5}[[:xdigit:]]{2}");
-regex regex_ipv4("^(?:(?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9])[.]){3}(?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9])$");
-regex regex_ipv6("((([0-9a-fA-F]){1,4})[:]){7}([0-9a-fA-F]){1,4}");
-regex regex_pre("[[:xdigit:]]{16}");
+// format a message into the buffer of the calling thread and queue it
+ostream &cea_log_begin();
+void cea_log_end(cea_log_level level);
 
 enum cea_field_type {
     Integer,
@@ -129,9 +172,30 @@ enum cea_stream_add_type {
     Field
 };
 
+// stages of the bootstrap of a stream, timed for the report made at start
+enum cea_boot_stage {
+    BOOT_Collate_Fields,
+    BOOT_Field_Offsets,
+    BOOT_Mutable_Fields,
+    BOOT_Plan_Load,
+    BOOT_Genspec,
+    BOOT_Runtime,
+    BOOT_Payload_Arrays,
+    BOOT_Meta_Templates,
+    BOOT_Principal_Frame,
+    BOOT_Plan_Save,
+    BOOT_Share_Plan,
+    BOOT_Prepare,
+    Num_Boot_Stages
+};
+
 struct cea_field_runtime {
     uint64_t value;
-    vector<uint64_t> patterns;
+    // values of a value list, shared by the copies of the field made for
+    // generation and by the clones of the stream. Points into the mapping
+    // when the plan was loaded from a file
+    shared_ptr<const uint64_t> patterns;
+    uint32_t nof_patterns;
     uint32_t count;
     uint32_t idx;
 };
@@ -153,8 +217,38 @@ struct cea_field_mutation_data {
     uint32_t offset;
 };
 
+// mt19937 of a field, allocated when the field is seeded so that the many
+// fields without random generation do not carry its 5KB of state
+class cea_field_engine {
+public:
+    typedef mt19937::result_type result_type;
+    cea_field_engine() = default;
+    cea_field_engine(cea_field_engine &&other) = default;
+    cea_field_engine(const cea_field_engine &other) {
+        *this = other;
+    }
+    cea_field_engine &operator=(cea_field_engine &&other) = default;
+    cea_field_engine &operator=(const cea_field_engine &other) {
+        engine = other.engine ? make_unique<mt19937>(*other.engine) : nullptr;
+        return *this;
+    }
+    void seed(result_type value) {
+        engine = make_unique<mt19937>(value);
+    }
+    static constexpr result_type min() { return mt19937::min(); }
+    static constexpr result_type max() { return mt19937::max(); }
+    result_type operator()() {
+        if (!engine) {
+            engine = make_unique<mt19937>();
+        }
+        return (*engine)();
+    }
+private:
+    unique_ptr<mt19937> engine;
+};
+
 struct cea_field_random {
-    mt19937 engine;
+    cea_field_engine engine;
     uniform_int_distribution<uint64_t> ud;
     discrete_distribution<uint64_t> wd;
     vector<uint64_t> wd_lenghts;
@@ -169,11 +263,68 @@ struct cea_field_mutation_spec {
     cea_field_random rnd;
 };
 
+// a field of a header set on a stream instead of on the header
+struct cea_field_override {
+    uint32_t header;    // index in the headers of the stream
+    uint32_t field;     // index in the fields of the header
+    cea_field_mutation_spec spec;
+};
+
 typedef enum  {
     NEW_FRAME,
     TRANSMIT
 } mutation_states;
 
+// staging area of a port where frames are laid out back-to-back in interface
+// width slots, so that a fill request is handed over in a single burst
+struct cea_txring {
+    unsigned char *base;
+    uint32_t width;    // size of a slot in bytes
+    uint32_t capacity; // total number of slots
+    uint32_t count;    // number of slots filled since the last burst
+};
+
+// ethernet frame check sequence, counted in the length of the generated
+// frames. The frames received on an interface have it stripped
+#define CEA_FCS_LEN 4
+
+struct CEA_PACKED tx_metadata {
+    uint64_t tx_disable_crc;
+    uint32_t len : 32;
+    uint8_t is_dummy;
+    uint8_t has_fcs;    // len counts the FCS, replayed frames have none
+    char pad_centre[1];
+    uint8_t start_stream_ch : 8;
+    uint32_t ipg : 32;
+    char pad_last[44];
+};
+
+// byte offset of tx_metadata::len, patched when frame sizes are not known
+// at compile time
+#define CEA_META_LEN_OFFSET 8
+
+// byte offset of tx_metadata::ipg, used to patch the ipg of a frame in place
+#define CEA_META_IPG_OFFSET 16
+
+struct CEA_PACKED rx_metadata {
+    uint32_t len : 32;
+    uint8_t has_fcs;    // the last CEA_FCS_LEN bytes of the frame are its FCS
+    char pad_centre[3];
+    uint32_t ipg : 32;
+    uint64_t rx_tstamp : 64;    // arrival time in ns, see cea_rx_assembler
+    char pad_init[64 - 21];
+    uint8_t id;
+};
+
+static_assert(sizeof(tx_metadata) == CEA_FRM_METASIZE, "tx_metadata must be 64B");
+static_assert(sizeof(rx_metadata) == CEA_FRM_METASIZE, "rx_metadata must be 64B");
+
+// Element type identifier
+uint8_t FRAME_ELEM = 0;
+uint8_t META_ELEM = 1;
+uint8_t FRAG_ELEM = 2;
+uint8_t EOS_ELEM  = 4;
+
 vector<unsigned char>def_pre_pattern    = {0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x5d};
 vector<unsigned char>def_dstmac_pattern = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
 vector<unsigned char>def_srcmac_pattern = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
@@ -268,7 +419,7 @@ vector<cea_field_mutation_spec> mtable = {
 { /*defaults*/ {0, Pause_Quanta_7        , 16 , 0, 0, "Pause_Quanta_7        ", 0                , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {0                , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
 { /*defaults*/ {0, FRAME_Len             , 32 , 0, 0, "FRAME_Len             ", 64               , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {64               , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
 { /*defaults*/ {0, PAYLOAD_Pattern       , 0  , 0, 0, "PAYLOAD_Pattern       ", 0                , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {0                , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {"00"               , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
-{ /*defaults*/ {0, STREAM_Traffic_Type   , 32 , 0, 0, "STREAM_Traffic_Type   ", Continuous       , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {Continuous       , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
+{ /*defaults*/ {0, STREAM_Traffic_Type   , 32 , 0, 0, "STREAM_Traffic_Type   ", Bursty           , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {Bursty           , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
 { /*defaults*/ {0, STREAM_Burst_Size     , 32 , 0, 0, "STREAM_Burst_Size     ", 10               , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {10               , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
 { /*defaults*/ {0, STREAM_Traffic_Control, 32 , 0, 0, "STREAM_Traffic_Control", Stop_After_Stream, {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {Stop_After_Stream, 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
 { /*defaults*/ {0, STREAM_Ipg            , 32 , 0, 0, "STREAM_Ipg            ", 12               , {0x00}             , Integer     }, /*gspec*/ {Fixed_Value , /*nmr*/ {12               , 0, 0, 0, 0, 0, 0, 0, 0, 0, {}, {}, ""}, /*str*/ {""                 , 0, "", "", 0, 0, "", 0, "", 0, {}}}, /*rt*/ {0, {}, 0, 0}, /*mdata*/ {0, 0}, /*rnd*/ {}},
@@ -492,41 +643,58 @@ vector<string> cea_field_type_name = {
 
 vector<string> cea_stream_feature_name = {
     "PCAP_Record_Tx_Enable",
-    "PCAP_Record_Rx_Enable"
+    "PCAP_Record_Rx_Enable",
+    "PCAPNG_Record_Tx_Enable",
+    "PCAP_Comment",
+    "PCAP_Replay_Source",
+    "Signature_Enable",
+    "Rx_Analyzer_Enable",
+    "Plan_Cache_Dir"
 };
 
-// file stream for cea message logging
-ofstream logfile;
-
-// custom output stream to sent messages to both screen and log file    
-int outbuf::overflow(int_type c) {
-    if (c != EOF) {
-    c = static_cast<char>(c);
-        logfile << static_cast<char>(c);
-        if (putchar(c) == EOF) {
-           return EOF;
-        }
-    }
-    return c;
-}
+vector<string> cea_boot_stage_name = {
+    "BOOT_Collate_Fields",
+    "BOOT_Field_Offsets",
+    "BOOT_Mutable_Fields",
+    "BOOT_Plan_Load",
+    "BOOT_Genspec",
+    "BOOT_Runtime",
+    "BOOT_Payload_Arrays",
+    "BOOT_Meta_Templates",
+    "BOOT_Principal_Frame",
+    "BOOT_Plan_Save",
+    "BOOT_Share_Plan",
+    "BOOT_Prepare"
+};
 
-//------------------------------------------------------------------------------
-// cea library init
-//------------------------------------------------------------------------------
+vector<string> cea_port_property_name = {
+    "PORT_Interface_Width",
+    "PORT_Line_Rate",
+    "PORT_Interleave",
+    "PORT_Backend",
+    "PORT_Loopback_Paced",
+    "PORT_Interface_Name",
+    "PORT_Socket_Path"
+};
 
-class cea_init {
-public:
-    cea_init() {
-        signal(SIGABRT, signal_handler);
-        logfile.open("run.log", ofstream::out);
-        if (!logfile.is_open()) {
+vector<string> cea_port_backend_name = {
+    "Gsfm_Backend",
+    "Loopback_Backend",
+    "AF_Packet_Backend",
+    "Shm_Backend"
+};
 
-            exit(1);
-        }
-    }
-    ~cea_init() { logfile.close(); }
+vector<string> cea_unit_name = {
+    "Percent",
+    "Frames_Per_Sec",
+    "Millisecond",
+    "Nanosecond",
+    "Bytes",
+    "Bits_Per_Sec",
+    "Kilobits_Per_Sec",
+    "Megabits_Per_Sec"
 };
-cea_init init;
+
 
 // utility
 bool in_range(uint32_t low, uint32_t high, uint32_t x) {        
@@ -656,6 +824,125 @@ string cea_timer::elapsed_in_string(int precision) {
     return ss.str();
 }
 
+//------------------------------------------------------------------------------
+// Element packers for the transmit ring
+//------------------------------------------------------------------------------
+
+// true if the width is a supported interface width
+bool cea_is_valid_ifwidth(uint64_t width) {
+    switch (width) {
+        case 16: case 32: case 64: case 128: case 256: case 512: return true;
+        default: return false;
+    }
+}
+
+// copy one element of W bytes to the ring bypassing the cache, the ring is
+// consumed by another agent so there is no point in polluting our cache
+template <uint32_t W>
+inline void cea_stream_elem(unsigned char *dst, const unsigned char *src) {
+#if defined(__SSE2__)
+    for (uint32_t i=0; i<W; i+=16) {
+        _mm_stream_si128((__m128i*)(dst+i), _mm_loadu_si128((const __m128i*)(src+i)));
+    }
+#else
+    memcpy(dst, src, W);
+#endif
+}
+
+// make the streamed elements visible before handing over the ring
+inline void cea_stream_fence() {
+#if defined(__SSE2__)
+    _mm_sfence();
+#else
+    atomic_thread_fence(memory_order_release);
+#endif
+}
+
+// back off in a loop that spins on a location written by another thread
+inline void cea_cpu_relax() {
+#if defined(__SSE2__)
+    _mm_pause();
+#else
+    this_thread::yield();
+#endif
+}
+
+// Packs a frame into consecutive W byte slots of the transmit ring. The
+// element count is computed with a shift since W is a power of 2. The tail
+// element is zero padded, the valid bytes in it are given by tail_bytes().
+// Elements read back on this core, as by the kernel for af_packet, are not
+// streamed but stored through the cache
+template <uint32_t W, bool Stream = true>
+class cea_packer {
+public:
+    static_assert(W >= 16 && W <= 512 && (W & (W-1)) == 0,
+        "interface width must be a power of 2 between 16 and 512");
+
+    static constexpr uint32_t shift = __builtin_ctz(W);
+
+    static uint32_t num_elems(uint32_t len) {
+        return (len + W - 1) >> shift;
+    }
+
+    static uint32_t tail_bytes(uint32_t len) {
+        return len - ((num_elems(len) - 1) << shift);
+    }
+
+    // pack n elements of the frame starting from element index first
+    static void pack(unsigned char *dst, const unsigned char *src,
+        uint32_t len, uint32_t first, uint32_t n) {
+        uint32_t last = first + n;
+        bool partial_tail = (last == num_elems(len)) && (tail_bytes(len) != W);
+        uint32_t nfull = partial_tail ? n - 1 : n;
+
+        src += (first << shift);
+        for (uint32_t idx=0; idx<nfull; idx++) {
+            store(dst, src);
+            dst += W;
+            src += W;
+        }
+        if (partial_tail) {
+            alignas(CEA_CACHELINE) unsigned char tail[W] = {};
+            memcpy(tail, src, tail_bytes(len));
+            store(dst, tail);
+        }
+    }
+
+private:
+    static void store(unsigned char *dst, const unsigned char *src) {
+        if (Stream) {
+            cea_stream_elem<W>(dst, src);
+        } else {
+            memcpy(dst, src, W);
+        }
+    }
+};
+
+// width specialized packer selected once per stream and port
+struct cea_pack_ops {
+    uint32_t (*num_elems)(uint32_t len);
+    void (*pack)(unsigned char *dst, const unsigned char *src,
+        uint32_t len, uint32_t first, uint32_t n);
+};
+
+template <uint32_t W>
+constexpr cea_pack_ops cea_make_pack_ops(bool stream) {
+    return stream
+        ? cea_pack_ops{cea_packer<W>::num_elems, cea_packer<W>::pack}
+        : cea_pack_ops{cea_packer<W, false>::num_elems, cea_packer<W, false>::pack};
+}
+
+cea_pack_ops cea_get_pack_ops(uint32_t width, bool stream = true) {
+    switch (width) {
+        case 16:  return cea_make_pack_ops<16>(stream);
+        case 32:  return cea_make_pack_ops<32>(stream);
+        case 128: return cea_make_pack_ops<128>(stream);
+        case 256: return cea_make_pack_ops<256>(stream);
+        case 512: return cea_make_pack_ops<512>(stream);
+        default:  return cea_make_pack_ops<64>(stream);
+    }
+}
+
 void print_uchar_array_1n (unsigned char* tmp, int len, string hdr) {
     stringstream s;
     s.str("");
@@ -708,193 +995,2917 @@ void print_uchar_array (unsigned char* tmp, int len, string hdr) {
 }
 
 //------------------------------------------------------------------------------
-// support for PCAP write
+// Lock-free single producer single consumer ring of variable length records
 //------------------------------------------------------------------------------
 
-class pcap {
-public:
-    // ctor
-    pcap(string filename, string name, uint32_t id);
+// marks the unused end of the ring when a record does not fit before the wrap
+#define CEA_RING_SKIP 0xFFFFFFFF
 
-    // dtor
-    ~pcap();
+// each record is prefixed with its length and padded to 8 bytes
+#define CEA_RING_REC_HDR 8
 
-    // write the given buffer into the pcap file
-    void write(unsigned char *buf, uint32_t len);
+class cea_spsc_ring {
+public:
+    // size must be a power of 2
+    cea_spsc_ring(uint64_t size);
+    ~cea_spsc_ring();
 
-    // name of the pcap file to create
-    string pcap_filename;
+    // producer: reserve contiguous space for a record of len bytes, returns
+    // nullptr when the ring is full. The record is visible after commit()
+    unsigned char *reserve(uint32_t len);
+    void commit();
 
-    // handle to the pcap file
-    ofstream pcapfile;
+    // consumer: returns the next record and its length or nullptr when the
+    // ring is empty. The space is returned to the producer after release()
+    unsigned char *peek(uint32_t &len);
+    void release();
 
-    bool file_exists(const string &filename);
+    // number of bytes queued in the ring
+    uint64_t occupancy();
 
-    // set when the object is created
-    string parent_name;
+private:
+    unsigned char *buf;
+    uint64_t size;
+    uint64_t mask;
 
-    // automatically assigned when the proxy object is created
-    // the value of the field is set from the global variable port_id
-    uint32_t parent_id;
+    // keep the producer and consumer indices in separate cache lines
+    alignas(CEA_CACHELINE) atomic<uint64_t> head;
+    alignas(CEA_CACHELINE) atomic<uint64_t> tail;
 
-    // build a string to be prefixed in all messages generated from this class
-    string msg_prefix;
+    // producer private
+    alignas(CEA_CACHELINE) uint64_t cached_head;
+    uint64_t next_tail;
 
-    // pcap global file header
-    struct CEA_PACKED pcap_file_hdr {
-        uint32_t magic : 32;
-        uint16_t version_major : 16;
-        uint16_t version_minor : 16;
-        uint32_t thiszone : 32;
-        uint32_t sigfigs : 32;
-        uint32_t snaplen : 32;
-        uint32_t linktype : 32;
-    } fh;
-    
-    // pcap per frame header
-    struct CEA_PACKED pcap_pkt_hdr {
-        uint32_t tv_sec : 32;
-        uint32_t tv_usec : 32;
-        uint32_t caplen : 32;
-        uint32_t len : 32;
-    } ph;
+    // consumer private
+    alignas(CEA_CACHELINE) uint64_t cached_tail;
+    uint64_t next_head;
 };
 
-pcap::pcap(string filename, string name, uint32_t id) {
-    pcap_filename = filename;
-    parent_name = name;
-    parent_id = id;
-    msg_prefix = parent_name + ":" + to_string(parent_id);
-
-    if (file_exists(pcap_filename)) {
-        if (remove(filename.c_str()) != 0) {
-            CEA_MSG("PCAP file " << filename <<
-                " already exists and cannot be deleted. Aborting...");
-            abort();
-        }
-    } else {
-        fh = {0xa1b2c3d4, 2, 4, 0, 0, 4194304, 1};
-        pcapfile.open(pcap_filename, ofstream::app);
-        pcapfile.write((char*)&fh, sizeof(pcap_file_hdr));
-        CEA_MSG("PCAP file created: " << pcap_filename);
-        pcapfile.flush();
-    }
+cea_spsc_ring::cea_spsc_ring(uint64_t size) {
+    this->size = size;
+    mask = size - 1;
+    buf = (unsigned char*) aligned_alloc(CEA_CACHELINE, size);
+    head.store(0);
+    tail.store(0);
+    cached_head = 0;
+    next_tail = 0;
+    cached_tail = 0;
+    next_head = 0;
 }
 
-pcap::~pcap() {
-    pcapfile.flush();
-    pcapfile.close();
+cea_spsc_ring::~cea_spsc_ring() {
+    free(buf);
 }
 
-// true if the file exists, else false
-bool pcap::file_exists(const string &filename) {
-    struct stat buf;
-    if (stat(filename.c_str(), &buf) != -1) {
-        return true;
+unsigned char *cea_spsc_ring::reserve(uint32_t len) {
+    uint64_t need = (len + CEA_RING_REC_HDR + 7) & ~7UL;
+    uint64_t t = tail.load(memory_order_relaxed);
+    uint64_t pos = t & mask;
+    uint64_t contig = size - pos;
+    uint64_t total = (need > contig) ? contig + need : need;
+
+    if (total > size - (t - cached_head)) {
+        cached_head = head.load(memory_order_acquire);
+        if (total > size - (t - cached_head)) {
+            return nullptr;
+        }
     }
-    return false;
+    if (need > contig) {
+        *(uint32_t*)(buf + pos) = CEA_RING_SKIP;
+        t += contig;
+        pos = 0;
+    }
+    *(uint32_t*)(buf + pos) = len;
+    next_tail = t + need;
+    return buf + pos + CEA_RING_REC_HDR;
 }
 
-void pcap::write(unsigned char *buf, uint32_t len) {
-    ph.caplen = len;
-    ph.len = len;
-    pcapfile.write((const char*)&ph, sizeof(pcap_pkt_hdr));
-    pcapfile.write((const char*)buf, len);
-    pcapfile.flush();
+void cea_spsc_ring::commit() {
+    tail.store(next_tail, memory_order_release);
 }
 
-// find_if with lambda predicate
-cea_field_mutation_spec get_field(vector<cea_field_mutation_spec> tbl, cea_field_id id) {
-    auto result = find_if(tbl.begin(), tbl.end(),
-        [&id](const cea_field_mutation_spec &item) {
-        return (item.defaults.id == id); });
-
-    if (result == tbl.end()) {
-        CEA_ERR_MSG("FATAL ERROR: " << "Unrecognized field id (" << id <<") passed to " << __func__);
-        abort();
+unsigned char *cea_spsc_ring::peek(uint32_t &len) {
+    uint64_t h = head.load(memory_order_relaxed);
+    while (true) {
+        if (h == cached_tail) {
+            cached_tail = tail.load(memory_order_acquire);
+            if (h == cached_tail) {
+                return nullptr;
+            }
+        }
+        uint64_t pos = h & mask;
+        uint32_t l = *(uint32_t*)(buf + pos);
+        if (l == CEA_RING_SKIP) {
+            h += size - pos;
+            head.store(h, memory_order_release);
+            continue;
+        }
+        len = l;
+        next_head = h + ((l + CEA_RING_REC_HDR + 7) & ~7UL);
+        return buf + pos + CEA_RING_REC_HDR;
     }
-    return (*result);
 }
 
-// CONTROLLER
-//------------------
-// Controller class
-//------------------
-class cea_controller {
-public:
-    cea_controller(){}
-    cea_port* gports[256];
-    uint32_t port_cntr = 0;
-    int do_mutate(int n, cea_port *p);
-};
-
-// Global controller instance for the current workstation
-cea_controller controller;
+void cea_spsc_ring::release() {
+    head.store(next_head, memory_order_release);
+}
 
+uint64_t cea_spsc_ring::occupancy() {
+    return tail.load(memory_order_relaxed) - head.load(memory_order_relaxed);
+}
 
-// STREAMH
-//-------------
-// Stream Core
-//-------------
+//------------------------------------------------------------------------------
+// TSC based time base of the generator
+//------------------------------------------------------------------------------
 
-class cea_stream::core {
+class cea_timebase {
 public:
-    // ctor
-    core(string name);
+    // calibrate the tsc against the system clock
+    cea_timebase();
 
-    // dtor
-    ~core();
+    // raw value of the free running counter
+    uint64_t ticks();
 
-    // Quickly set a fixed value to a property
-    void set(cea_field_id id, uint64_t value);
+    // convert a number of ticks to nanoseconds
+    uint64_t ticks_to_ns(uint64_t ticks);
 
-    // Define a complete spec for the generation of a property
-    void set(cea_field_id id, cea_field_genspec spec);
+    // nanoseconds since the epoch derived from the counter
+    uint64_t now_ns();
 
-    // enable or disable a stream feature
-    void set(cea_stream_feature_id feature, bool mode);
+    // nanoseconds since the epoch of an earlier raw value of the counter
+    uint64_t epoch_ns(uint64_t ticks);
 
-    // Based on user specification of the frame, build a vector of 
-    // field ids in the sequence required by the specification
-    void collate_frame_fields();
+private:
+    uint64_t base_ticks;
+    uint64_t base_ns;
 
-    // The addition of mpls/vlan/llc/snap affects the position of ethertype and
-    // length fields. update/insert type or len after arranging all fields in
-    // the required sequence
-    // TODO check if this is required
-    void update_ethertype_and_len();
+    // nanoseconds per tick in 32.32 fixed point
+    uint64_t mult;
+};
 
-    // evaluate field length and calculate offset of all fields of this stream
-    void build_field_offsets();
+cea_timebase::cea_timebase() {
+    timespec mono0, mono1, real0;
+    clock_gettime(CLOCK_MONOTONIC, &mono0);
+    clock_gettime(CLOCK_REALTIME, &real0);
+    base_ticks = ticks();
+    this_thread::sleep_for(milliseconds(10));
+    uint64_t end_ticks = ticks();
+    clock_gettime(CLOCK_MONOTONIC, &mono1);
+
+    uint64_t elapsed_ns = (mono1.tv_sec - mono0.tv_sec) * 1000000000UL
+        + mono1.tv_nsec - mono0.tv_nsec;
+    uint64_t elapsed_ticks = end_ticks - base_ticks;
+    mult = elapsed_ticks ? ((unsigned __int128)elapsed_ns << 32) / elapsed_ticks
+                         : (1UL << 32);
+    base_ns = real0.tv_sec * 1000000000UL + real0.tv_nsec;
+}
 
-    // build cseq by parsing fseq and adding only mutable fields
-    void filter_mutable_fields();
+uint64_t cea_timebase::ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
 
-    // concatenate all fields reuired by the frame spec
-    uint32_t splice_frame_fields(unsigned char *buf);
+uint64_t cea_timebase::ticks_to_ns(uint64_t ticks) {
+    return ((unsigned __int128)ticks * mult) >> 32;
+}
 
-    // build size and payload pattern arrays
-    void build_payload_arrays();
+uint64_t cea_timebase::now_ns() {
+    return epoch_ns(ticks());
+}
 
-    void prepare_genspec();
+uint64_t cea_timebase::epoch_ns(uint64_t ticks) {
+    return base_ns + ticks_to_ns(ticks - base_ticks);
+}
 
-    void build_runtime();
+cea_timebase timebase;
 
-    void build_principal_frame();
+//------------------------------------------------------------------------------
+// support for parsing
+//------------------------------------------------------------------------------
 
-    // process the headers and fields and prepare for generation
-    void bootstrap_stream();
+// single pass parsers of the user supplied addresses and patterns, they
+// validate and convert in one step without allocating. All of them return
+// false on malformed input and leave the output undefined
+
+// value of a hex digit
+static inline bool cea_parse_nibble(char c, uint32_t &value) {
+    if (c >= '0' && c <= '9') {
+        value = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        value = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        value = c - 'A' + 10;
+    } else {
+        return false;
+    }
+    return true;
+}
 
-    // begin generation
-    void mutate();
+// dotted quad in [p, end), octets are 0 to 255 without leading zeros
+static bool cea_parse_ipv4(const char *p, const char *end, uint32_t &addr) {
+    addr = 0;
+    for (uint32_t octet = 0; octet < 4; octet++) {
+        if (octet > 0) {
+            if (p == end || *p != '.') return false;
+            p++;
+        }
+        const char *start = p;
+        uint32_t value = 0;
+        while (p < end && *p >= '0' && *p <= '9' && p - start < 3) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        uint32_t digits = p - start;
+        if (digits == 0 || value > 255 || (digits > 1 && *start == '0')) {
+            return false;
+        }
+        addr = (addr << 8) | value;
+    }
+    return p == end;
+}
 
-    // print the frame structure, mutable fields and stream properties
-    void print_stream();
+bool cea_parse_ipv4(const string &s, uint32_t &addr) {
+    return cea_parse_ipv4(s.data(), s.data() + s.size(), addr);
+}
 
-    // print a vector of field specs
-    void print_fields(vector<cea_field_mutation_spec> field_group);
+// six groups of two hex digits, each of the first five optionally followed
+// by a colon
+bool cea_parse_mac(const string &s, uint64_t &mac) {
+    const char *p = s.data();
+    const char *end = p + s.size();
+    mac = 0;
+    for (uint32_t group = 0; group < 6; group++) {
+        uint32_t hi, lo;
+        if (end - p < 2 || !cea_parse_nibble(p[0], hi)
+            || !cea_parse_nibble(p[1], lo)) {
+            return false;
+        }
+        mac = (mac << 8) | (hi << 4) | lo;
+        p += 2;
+        if (group < 5 && p < end && *p == ':') p++;
+    }
+    return p == end;
+}
 
-    // Factory reset of the stream core
+// eight groups of up to four hex digits in network byte order. A run of zero
+// groups may be compressed to '::' once and the last two groups may be
+// written as a dotted quad
+bool cea_parse_ipv6(const string &s, unsigned char *addr) {
+    const char *p = s.data();
+    const char *end = p + s.size();
+    uint16_t groups[8];
+    int32_t nof_groups = 0;
+    int32_t gap = -1;
+
+    if (p == end) return false;
+    if (*p == ':') {
+        if (end - p < 2 || p[1] != ':') return false;
+        gap = 0;
+        p += 2;
+    }
+    while (p < end) {
+        if (nof_groups == 8) return false;
+        const char *start = p;
+        uint32_t value = 0, nibble;
+        while (p < end && p - start < 5 && cea_parse_nibble(*p, nibble)) {
+            value = (value << 4) | nibble;
+            p++;
+        }
+        if (p < end && *p == '.') {
+            uint32_t v4;
+            if (nof_groups > 6 || !cea_parse_ipv4(start, end, v4)) {
+                return false;
+            }
+            groups[nof_groups++] = v4 >> 16;
+            groups[nof_groups++] = v4 & 0xffff;
+            p = end;
+            break;
+        }
+        if (p == start || p - start > 4) return false;
+        groups[nof_groups++] = value;
+        if (p == end) break;
+        if (*p != ':') return false;
+        p++;
+        if (p < end && *p == ':') {
+            if (gap >= 0) return false;
+            gap = nof_groups;
+            p++;
+        } else if (p == end) {
+            return false;
+        }
+    }
+    if (gap < 0 ? nof_groups != 8 : nof_groups > 7) {
+        return false;
+    }
+
+    // expand the compressed groups
+    memset(addr, 0, 16);
+    for (int32_t g = 0, idx = 0; g < nof_groups; g++, idx++) {
+        if (g == gap) idx += 8 - nof_groups;
+        addr[2*idx] = groups[g] >> 8;
+        addr[2*idx+1] = groups[g] & 0xff;
+    }
+    return true;
+}
+
+// hex number of up to 16 digits
+bool cea_parse_hex(const string &s, uint64_t &value) {
+    if (s.empty() || s.size() > 16) return false;
+    value = 0;
+    for (char c : s) {
+        uint32_t nibble;
+        if (!cea_parse_nibble(c, nibble)) return false;
+        value = (value << 4) | nibble;
+    }
+    return true;
+}
+
+// hex string of an even number of digits to bytes in the given order
+bool cea_parse_hex(const string &s, unsigned char *bytes) {
+    if (s.empty() || (s.size() % 2) != 0) return false;
+    for (size_t idx = 0; idx < s.size(); idx += 2) {
+        uint32_t hi, lo;
+        if (!cea_parse_nibble(s[idx], hi) || !cea_parse_nibble(s[idx+1], lo)) {
+            return false;
+        }
+        bytes[idx/2] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// support for logging
+//------------------------------------------------------------------------------
+
+// ring of a logging thread (256KB)
+#define CEA_LOG_RING_SIZE (256UL*1024)
+
+// threads that can log at the same time, the rings of finished threads are
+// reused. Further threads write their messages synchronously
+#define CEA_LOG_MAX_THREADS 256
+
+// Asynchronous logger. A thread formats a message in its own buffer and
+// queues it as a record into its own ring, the logger thread drains all rings
+// in timestamp order to the console and to run.log. A message is dropped
+// rather than blocking the thread when the ring is full. Errors are written
+// out before the call returns
+class cea_logger {
+public:
+    cea_logger();
+    ~cea_logger();
+
+    void write(cea_log_level level, const string &text);
+
+    // write out every message queued so far
+    void flush();
+
+    // the formatting buffer of the calling thread, emptied and its text
+    ostringstream &local_stream();
+    string local_text() { return local.stream.str(); }
+
+private:
+    struct rec_hdr {
+        uint64_t tstamp;
+        uint32_t level;
+    };
+
+    struct source {
+        cea_spsc_ring *ring;
+        atomic<bool> in_use;
+    };
+
+    // released when the thread exits so that its ring can be reused
+    struct local_source {
+        source *src = nullptr;
+        ostringstream stream;
+        ~local_source() {
+            if (src) src->in_use.store(false, memory_order_release);
+        }
+    };
+    static thread_local local_source local;
+
+    source *attach();
+    void drain_thread();
+    void drain();
+    void output(const char *text, uint32_t len);
+
+    source sources[CEA_LOG_MAX_THREADS];
+    atomic<uint32_t> nof_sources;
+    mutex attach_lock;
+
+    // the consumer side of the rings, taken by the logger thread and flush()
+    mutex drain_lock;
+    vector<pair<rec_hdr, string>> batch;
+
+    FILE *file;
+    thread tid;
+    atomic<bool> stopping;
+    atomic<uint64_t> drops;
+};
+
+thread_local cea_logger::local_source cea_logger::local;
+
+cea_logger::cea_logger() {
+    nof_sources.store(0);
+    drops.store(0);
+    stopping.store(false);
+    signal(SIGABRT, signal_handler);
+    file = fopen("run.log", "w");
+    if (file == nullptr) {
+        exit(1);
+    }
+    tid = thread(&cea_logger::drain_thread, this);
+    pthread_setname_np(tid.native_handle(), "logger");
+}
+
+cea_logger::~cea_logger() {
+    stopping.store(true, memory_order_release);
+    if (tid.joinable()) {
+        tid.join();
+    }
+    drain();
+    if (drops.load() != 0) {
+        string msg = "(cea|logger  ): " + to_string(drops.load())
+            + " messages dropped\n";
+        output(msg.data(), msg.size());
+    }
+    fclose(file);
+    for (uint32_t idx = 0; idx < nof_sources.load(); idx++) {
+        delete sources[idx].ring;
+    }
+}
+
+ostringstream &cea_logger::local_stream() {
+    ostringstream &s = local.stream;
+    s.str("");
+    s.clear();
+    s.flags(ios_base::dec | ios_base::skipws);
+    s.precision(6);
+    s.fill(' ');
+    return s;
+}
+
+// take a free ring or add one, the lock is only taken at the first message
+// of a thread
+cea_logger::source *cea_logger::attach() {
+    lock_guard<mutex> guard(attach_lock);
+    uint32_t n = nof_sources.load(memory_order_relaxed);
+    for (uint32_t idx = 0; idx < n; idx++) {
+        source &src = sources[idx];
+        if (!src.in_use.load(memory_order_acquire) && src.ring->occupancy() == 0) {
+            src.in_use.store(true, memory_order_relaxed);
+            return &src;
+        }
+    }
+    if (n == CEA_LOG_MAX_THREADS) return nullptr;
+    sources[n].ring = new cea_spsc_ring(CEA_LOG_RING_SIZE);
+    sources[n].in_use.store(true, memory_order_relaxed);
+    nof_sources.store(n + 1, memory_order_release);
+    return &sources[n];
+}
+
+void cea_logger::write(cea_log_level level, const string &text) {
+    if (local.src == nullptr) {
+        local.src = attach();
+        if (local.src == nullptr) {
+            // out of rings, write in place
+            lock_guard<mutex> guard(drain_lock);
+            string line = text + "\n";
+            output(line.data(), line.size());
+            return;
+        }
+    }
+    uint32_t len = sizeof(rec_hdr) + text.size();
+    unsigned char *rec = local.src->ring->reserve(len);
+    if (rec == nullptr) {
+        drops.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    rec_hdr hdr = {timebase.ticks(), level};
+    memcpy(rec, &hdr, sizeof(rec_hdr));
+    memcpy(rec + sizeof(rec_hdr), text.data(), text.size());
+    local.src->ring->commit();
+    if (level == LOG_Error) {
+        flush();
+    }
+}
+
+void cea_logger::output(const char *text, uint32_t len) {
+    fwrite(text, 1, len, stdout);
+    fwrite(text, 1, len, file);
+}
+
+// take everything queued, order it by time across the threads and write it
+void cea_logger::drain() {
+    lock_guard<mutex> guard(drain_lock);
+    batch.clear();
+    uint32_t n = nof_sources.load(memory_order_acquire);
+    for (uint32_t idx = 0; idx < n; idx++) {
+        cea_spsc_ring *ring = sources[idx].ring;
+        uint32_t len;
+        unsigned char *rec;
+        while ((rec = ring->peek(len)) != nullptr) {
+            rec_hdr hdr;
+            memcpy(&hdr, rec, sizeof(rec_hdr));
+            batch.push_back({hdr, string((char*) rec + sizeof(rec_hdr),
+                len - sizeof(rec_hdr))});
+            ring->release();
+        }
+    }
+    if (batch.empty()) return;
+    stable_sort(batch.begin(), batch.end(), [](const auto &x, const auto &y) {
+        return x.first.tstamp < y.first.tstamp; });
+    string out;
+    for (auto &item : batch) {
+        out += item.second;
+        out += '\n';
+    }
+    output(out.data(), out.size());
+    fflush(stdout);
+    fflush(file);
+}
+
+void cea_logger::flush() {
+    drain();
+}
+
+void cea_logger::drain_thread() {
+    while (!stopping.load(memory_order_acquire)) {
+        drain();
+        this_thread::sleep_for(microseconds(500));
+    }
+}
+
+cea_logger logger;
+
+ostream &cea_log_begin() {
+    return logger.local_stream();
+}
+
+void cea_log_end(cea_log_level level) {
+    logger.write(level, logger.local_text());
+}
+
+// the text written to cealog is queued line by line
+thread_local string cea_log_line;
+
+int outbuf::overflow(int_type c) {
+    if (c == EOF) return c;
+    if (c == '\n') {
+        logger.write(LOG_Info, cea_log_line);
+        cea_log_line.clear();
+    } else {
+        cea_log_line += static_cast<char>(c);
+    }
+    return c;
+}
+
+streamsize outbuf::xsputn(const char *s, streamsize n) {
+    const char *end = s + n;
+    while (s < end) {
+        const char *nl = (const char*) memchr(s, '\n', end - s);
+        if (nl == nullptr) {
+            cea_log_line.append(s, end - s);
+            break;
+        }
+        cea_log_line.append(s, nl - s);
+        logger.write(LOG_Info, cea_log_line);
+        cea_log_line.clear();
+        s = nl + 1;
+    }
+    return n;
+}
+
+//------------------------------------------------------------------------------
+// support for statistics
+//------------------------------------------------------------------------------
+
+// Counters owned by one writer thread. The block fills whole cache lines so
+// that the blocks of different threads never share one. The owner updates
+// them without atomic read-modify-write, any thread may read them at any time
+struct alignas(CEA_CACHELINE) cea_stat_block {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t elements;
+    uint64_t stalls;
+    uint64_t rate_waits;
+    uint64_t pcap_drops;
+    uint64_t errors;
+
+    cea_stat_block() { memset(this, 0, sizeof(*this)); }
+
+    static inline void add(uint64_t &c, uint64_t n) {
+        __atomic_store_n(&c, c + n, __ATOMIC_RELAXED);
+    }
+
+    // accumulate into the counters of a snapshot
+    void read(cea_counters &c) const {
+        c.frames += __atomic_load_n(&frames, __ATOMIC_RELAXED);
+        c.bytes += __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+        c.elements += __atomic_load_n(&elements, __ATOMIC_RELAXED);
+        c.stalls += __atomic_load_n(&stalls, __ATOMIC_RELAXED);
+        c.rate_waits += __atomic_load_n(&rate_waits, __ATOMIC_RELAXED);
+        c.pcap_drops += __atomic_load_n(&pcap_drops, __ATOMIC_RELAXED);
+        c.errors += __atomic_load_n(&errors, __ATOMIC_RELAXED);
+    }
+};
+
+//------------------------------------------------------------------------------
+// support for tracing
+//------------------------------------------------------------------------------
+
+// Hot path tracing. A trace point of a level above CEA_TRACE_LEVEL compiles
+// to nothing, so release builds carry no tracing at all. The other points
+// store a binary event into a ring of the calling thread, which keeps the
+// latest CEA_TRACE_EVENTS events. The rings are formatted into run.trace
+// when the testbench stops. The per frame events are opt-in with
+// -DCEA_TRACE_LEVEL=2 (make TRACE=2) since they slow down the hot path
+#if !defined(CEA_TRACE_LEVEL)
+#if defined(CEA_DEVEL) || defined(CEA_DEBUG)
+    #define CEA_TRACE_LEVEL 1   // per burst events
+#else
+    #define CEA_TRACE_LEVEL 0
+#endif
+#endif
+
+// events kept per thread, a power of 2
+#define CEA_TRACE_EVENTS 65536
+
+enum cea_trace_id {
+    TRACE_State,            // stream, state
+    TRACE_New_Frame,        // stream, frame length, elements
+    TRACE_Frame_Done,       // stream, frames transmitted, elements
+    TRACE_Gap,              // stream, gap length, elements
+    TRACE_Fill              // port, elements requested, elements generated
+};
+
+#if CEA_TRACE_LEVEL > 0
+
+vector<string> cea_trace_name = {
+    "State",
+    "New_Frame",
+    "Frame_Done",
+    "Gap",
+    "Fill"
+};
+
+struct cea_trace_event {
+    uint64_t tstamp;
+    uint32_t id;
+    uint32_t a;
+    uint64_t b;
+    uint64_t c;
+};
+
+struct cea_trace_ring {
+    cea_trace_event ev[CEA_TRACE_EVENTS];
+    uint64_t count;
+    string name;
+    bool orphaned;  // the thread has exited, freed once formatted
+};
+
+// all rings not freed yet, the lock is only taken when a thread records its
+// first event or exits and when the rings are formatted
+mutex cea_trace_lock;
+vector<cea_trace_ring*> cea_trace_rings;
+thread_local cea_trace_ring *cea_trace_local = nullptr;
+
+// marks the ring of a thread when the thread exits
+struct cea_trace_owner {
+    cea_trace_ring *ring = nullptr;
+    ~cea_trace_owner() {
+        if (ring == nullptr) return;
+        lock_guard<mutex> guard(cea_trace_lock);
+        ring->orphaned = true;
+    }
+};
+thread_local cea_trace_owner cea_trace_owner_local;
+
+// frees the rings left at exit
+struct cea_trace_teardown {
+    ~cea_trace_teardown() {
+        for (auto r : cea_trace_rings) {
+            delete r;
+        }
+        cea_trace_rings.clear();
+    }
+} cea_trace_at_exit;
+
+// port workers that are running, their rings are formatted only when there
+// are none. The caller of DataQ_fill must have stopped before the testbench
+atomic<uint32_t> cea_trace_writers(0);
+
+static cea_trace_ring *cea_trace_register() {
+    cea_trace_ring *r = new cea_trace_ring;
+    r->count = 0;
+    r->orphaned = false;
+    char tname[16] = {};
+    pthread_getname_np(pthread_self(), tname, sizeof(tname));
+    r->name = tname;
+    lock_guard<mutex> guard(cea_trace_lock);
+    cea_trace_rings.push_back(r);
+    cea_trace_local = r;
+    cea_trace_owner_local.ring = r;
+    return r;
+}
+
+static inline void cea_trace(uint32_t id, uint32_t a, uint64_t b, uint64_t c) {
+    cea_trace_ring *r = cea_trace_local;
+    if (__builtin_expect(r == nullptr, 0)) {
+        r = cea_trace_register();
+    }
+    cea_trace_event &e = r->ev[r->count & (CEA_TRACE_EVENTS - 1)];
+    e.tstamp = timebase.ticks();
+    e.id = id;
+    e.a = a;
+    e.b = b;
+    e.c = c;
+    r->count++;
+}
+
+// format the events of all threads, oldest first, empty the rings and free
+// those of the threads that have exited
+static void cea_trace_dump(string fname) {
+    if (cea_trace_writers.load(memory_order_acquire) != 0) {
+        CEA_MSG("Ports are still running, " << fname << " is not written");
+        return;
+    }
+    lock_guard<mutex> guard(cea_trace_lock);
+    vector<pair<cea_trace_event, string>> all;
+    for (auto r : cea_trace_rings) {
+        uint64_t first = (r->count > CEA_TRACE_EVENTS) ? r->count - CEA_TRACE_EVENTS : 0;
+        for (uint64_t n = first; n < r->count; n++) {
+            all.push_back({r->ev[n & (CEA_TRACE_EVENTS - 1)], r->name});
+        }
+        r->count = 0;
+    }
+    auto orphans = stable_partition(cea_trace_rings.begin(),
+        cea_trace_rings.end(), [](cea_trace_ring *r) { return !r->orphaned; });
+    for (auto it = orphans; it != cea_trace_rings.end(); it++) {
+        delete *it;
+    }
+    cea_trace_rings.erase(orphans, cea_trace_rings.end());
+    if (all.empty()) return;
+    stable_sort(all.begin(), all.end(), [](const auto &x, const auto &y) {
+        return x.first.tstamp < y.first.tstamp; });
+
+    ofstream out(fname);
+    uint64_t t0 = all.front().first.tstamp;
+    for (auto &item : all) {
+        const cea_trace_event &e = item.first;
+        out << setw(12) << right << timebase.ticks_to_ns(e.tstamp - t0) << " "
+            << setw(16) << left << item.second << " "
+            << setw(12) << left << cea_trace_name[e.id] << " "
+            << e.a << " " << e.b << " " << e.c << "\n";
+    }
+}
+
+#define CEA_TRACE(level, id, a, b, c) { \
+    if (level <= CEA_TRACE_LEVEL) cea_trace(id, a, b, c); \
+}
+
+#else
+
+#define CEA_TRACE(level, id, a, b, c) {}
+
+#endif
+
+//------------------------------------------------------------------------------
+// support for PCAP write
+//------------------------------------------------------------------------------
+
+// size of the queue between the generation thread and the pcap writer (64MB)
+#define CEA_PCAP_RING_SIZE (64UL*1024*1024)
+
+// size of the aligned buffer in which the writer coalesces records (1MB)
+#define CEA_PCAP_BUF_SIZE (1UL*1024*1024)
+
+// alignment of the file writes, required when the file is opened O_DIRECT
+#define CEA_PCAP_BLOCK_SIZE 4096
+
+// Output file shared by one or more pcap writers. Appends are lock-free, each
+// writer reserves a range at the end of the file and writes it with pwrite
+class cea_pcap_file {
+public:
+    // direct requests O_DIRECT, granted only if the filesystem allows it
+    cea_pcap_file(string filename, bool direct);
+    ~cea_pcap_file();
+
+    // append len bytes at the end of the file, safe from several threads
+    // since the reserved ranges never overlap
+    void append(unsigned char *buf, uint64_t len);
+
+    // required before appending a length that is not block aligned
+    void disable_direct();
+
+    string filename;
+    string msg_prefix;
+    int fd;
+    bool direct;
+    atomic<uint64_t> end;
+};
+
+cea_pcap_file::cea_pcap_file(string filename, bool direct) {
+    this->filename = filename;
+    msg_prefix = filename;
+
+    struct stat buf;
+    if (stat(filename.c_str(), &buf) != -1) {
+        if (remove(filename.c_str()) != 0) {
+            CEA_MSG("PCAP file " << filename <<
+                " already exists and cannot be deleted. Aborting...");
+            abort();
+        }
+    }
+
+    fd = -1;
+    if (direct) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    }
+    this->direct = (fd >= 0);
+    if (fd < 0) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0) {
+        CEA_ERR_MSG("PCAP file " << filename << " cannot be created");
+        abort();
+    }
+    end.store(0);
+}
+
+cea_pcap_file::~cea_pcap_file() {
+    close(fd);
+}
+
+void cea_pcap_file::disable_direct() {
+    if (direct) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        direct = false;
+    }
+}
+
+void cea_pcap_file::append(unsigned char *buf, uint64_t len) {
+    uint64_t offset = end.fetch_add(len, memory_order_relaxed);
+    uint64_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINVAL && direct) {
+            disable_direct();
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            CEA_ERR_MSG("Write to PCAP file " << filename << " failed");
+            abort();
+        }
+        done += n;
+    }
+}
+
+// pcapng file with one interface description block per port. The enhanced
+// packet blocks are formatted by the pcap writers and appended concurrently
+class pcapng {
+public:
+    pcapng(string filename);
+    ~pcapng();
+
+    // write an interface description block and return its interface id.
+    // Interfaces must be added before any frame is recorded
+    uint32_t add_interface(string name);
+
+    // length of the enhanced packet block of a frame
+    static uint32_t epb_len(uint32_t len, const string &comment);
+
+    // format the enhanced packet block of a frame given in two parts at dst
+    static void format_epb(unsigned char *dst, uint32_t ifid, uint64_t ts_ns,
+        const unsigned char *head, uint32_t head_len,
+        const unsigned char *tail, uint32_t tail_len, const string &comment);
+
+    cea_pcap_file *file;
+    uint32_t nof_interfaces;
+    string msg_prefix;
+};
+
+inline uint32_t cea_pad4(uint32_t len) {
+    return (len + 3) & ~3U;
+}
+
+pcapng::pcapng(string filename) {
+    msg_prefix = filename;
+    file = new cea_pcap_file(filename, false);
+    nof_interfaces = 0;
+
+    // section header block
+    uint32_t shb[7] = {0x0A0D0D0A, 28, 0x1A2B3C4D, 0x00000001, 0xFFFFFFFF,
+        0xFFFFFFFF, 28};
+    file->append((unsigned char*)shb, sizeof(shb));
+    CEA_MSG("PCAPNG file created: " << filename);
+}
+
+pcapng::~pcapng() {
+    delete file;
+}
+
+uint32_t pcapng::add_interface(string name) {
+    uint32_t namelen = cea_pad4(name.size());
+    uint32_t blen = 16 + (4 + namelen) + (4 + 4) + 4 + 4;
+    vector<unsigned char> blk(blen, 0);
+    unsigned char *p = blk.data();
+
+    *(uint32_t*)(p+0) = 0x00000001;           // block type
+    *(uint32_t*)(p+4) = blen;
+    *(uint16_t*)(p+8) = 1;                    // linktype ethernet
+    *(uint32_t*)(p+12) = CEA_MAX_FRAME_SIZE;  // snaplen
+    p += 16;
+    *(uint16_t*)(p+0) = 2;                    // if_name
+    *(uint16_t*)(p+2) = name.size();
+    memcpy(p+4, name.data(), name.size());
+    p += 4 + namelen;
+    *(uint16_t*)(p+0) = 9;                    // if_tsresol
+    *(uint16_t*)(p+2) = 1;
+    *(uint8_t*)(p+4) = 9;                     // nanoseconds
+    p += 8;
+    p += 4;                                   // opt_endofopt
+    *(uint32_t*)(p) = blen;
+
+    file->append(blk.data(), blen);
+    return nof_interfaces++;
+}
+
+uint32_t pcapng::epb_len(uint32_t len, const string &comment) {
+    uint32_t optlen = comment.empty() ? 0 : (4 + cea_pad4(comment.size()) + 4);
+    return 28 + cea_pad4(len) + optlen + 4;
+}
+
+void pcapng::format_epb(unsigned char *dst, uint32_t ifid, uint64_t ts_ns,
+    const unsigned char *head, uint32_t head_len,
+    const unsigned char *tail, uint32_t tail_len, const string &comment) {
+    uint32_t len = head_len + tail_len;
+    uint32_t blen = epb_len(len, comment);
+    uint32_t padded = cea_pad4(len);
+
+    *(uint32_t*)(dst+0) = 0x00000006;         // block type
+    *(uint32_t*)(dst+4) = blen;
+    *(uint32_t*)(dst+8) = ifid;
+    *(uint32_t*)(dst+12) = ts_ns >> 32;
+    *(uint32_t*)(dst+16) = ts_ns & 0xFFFFFFFF;
+    *(uint32_t*)(dst+20) = len;               // captured length
+    *(uint32_t*)(dst+24) = len;               // original length
+    memcpy(dst+28, head, head_len);
+    memcpy(dst+28+head_len, tail, tail_len);
+    memset(dst+28+len, 0, padded-len);
+    unsigned char *p = dst + 28 + padded;
+    if (!comment.empty()) {
+        uint32_t clen = cea_pad4(comment.size());
+        *(uint16_t*)(p+0) = 1;                // opt_comment
+        *(uint16_t*)(p+2) = comment.size();
+        memcpy(p+4, comment.data(), comment.size());
+        memset(p+4+comment.size(), 0, clen-comment.size());
+        p += 4 + clen;
+        *(uint32_t*)(p) = 0;                  // opt_endofopt
+        p += 4;
+    }
+    *(uint32_t*)(p) = blen;
+}
+
+// Asynchronous pcap writer. Frames are queued by the generation thread and a
+// writer thread coalesces them into large writes to a legacy pcap file of its
+// own or to an interface of a shared pcapng file
+class pcap {
+public:
+    // record into a legacy pcap file of its own
+    pcap(string filename, string name, uint32_t id);
+
+    // record into interface ifid of a shared pcapng file
+    pcap(pcapng *ng, uint32_t ifid, string name, uint32_t id, string comment);
+
+    // dtor
+    ~pcap();
+
+    // queue the given buffer for recording, never blocks the caller. The
+    // frame is copied since the principal frame is mutated in place
+    void write(unsigned char *buf, uint32_t len);
+
+    // queue a frame made of a head and a tail, used by pcap replay where
+    // only the head of the frame is mutated. The frame is stamped with ts_ns
+    // when given, otherwise with the current time. Returns false when the
+    // writer fell behind and the frame is dropped
+    bool write(const unsigned char *head, uint32_t head_len,
+        const unsigned char *tail, uint32_t tail_len, uint64_t ts_ns = 0);
+
+    // drain the queued frames to the file and stop the writer thread
+    void close();
+
+    // set when the object is created
+    string parent_name;
+
+    // automatically assigned when the proxy object is created
+    // the value of the field is allocated from the port registry
+    uint32_t parent_id;
+
+    // build a string to be prefixed in all messages generated from this class
+    string msg_prefix;
+
+    // pcap global file header
+    struct CEA_PACKED pcap_file_hdr {
+        uint32_t magic : 32;
+        uint16_t version_major : 16;
+        uint16_t version_minor : 16;
+        uint32_t thiszone : 32;
+        uint32_t sigfigs : 32;
+        uint32_t snaplen : 32;
+        uint32_t linktype : 32;
+    } fh;
+    
+    // pcap per frame header
+    struct CEA_PACKED pcap_pkt_hdr {
+        uint32_t tv_sec : 32;
+        uint32_t tv_nsec : 32;
+        uint32_t caplen : 32;
+        uint32_t len : 32;
+    } ph;
+
+    // number of frames dropped because the writer fell behind
+    atomic<uint64_t> drops;
+
+private:
+    void start_writer();
+
+    // writer thread, coalesces the queued records into the output buffer
+    void writer();
+
+    // append the output buffer to the file, only whole blocks unless final
+    void write_out(bool final);
+
+    // pcapng interface to record into, null for a legacy pcap file
+    pcapng *ng;
+    uint32_t ifid;
+    string comment;
+
+    cea_pcap_file *file;
+    cea_spsc_ring *ring;
+    thread writer_tid;
+    atomic<bool> stopping;
+    bool closed;
+
+    unsigned char *obuf;
+    uint64_t olen;
+};
+
+pcap::pcap(string filename, string name, uint32_t id) {
+    parent_name = name;
+    parent_id = id;
+    msg_prefix = parent_name + ":" + to_string(parent_id);
+    ng = nullptr;
+    ifid = 0;
+
+    // bypass the page cache when the filesystem allows it
+    file = new cea_pcap_file(filename, true);
+    start_writer();
+
+    // nanosecond resolution legacy header
+    fh = {0xa1b23c4d, 2, 4, 0, 0, CEA_MAX_FRAME_SIZE, 1};
+    memcpy(obuf, &fh, sizeof(pcap_file_hdr));
+    olen = sizeof(pcap_file_hdr);
+    CEA_MSG("PCAP file created: " << filename);
+}
+
+pcap::pcap(pcapng *ng, uint32_t ifid, string name, uint32_t id, string comment) {
+    parent_name = name;
+    parent_id = id;
+    msg_prefix = parent_name + ":" + to_string(parent_id);
+    this->ng = ng;
+    this->ifid = ifid;
+    this->comment = comment;
+    file = ng->file;
+    start_writer();
+}
+
+pcap::~pcap() {
+    close();
+}
+
+void pcap::start_writer() {
+    obuf = (unsigned char*) aligned_alloc(CEA_PCAP_BLOCK_SIZE, CEA_PCAP_BUF_SIZE);
+    olen = 0;
+    ring = new cea_spsc_ring(CEA_PCAP_RING_SIZE);
+    drops.store(0);
+    stopping.store(false);
+    closed = false;
+
+    writer_tid = thread(&pcap::writer, this);
+    char tname[16];
+    snprintf(tname, sizeof(tname), "pcap_%d", parent_id);
+    pthread_setname_np(writer_tid.native_handle(), tname);
+}
+
+void pcap::write(unsigned char *buf, uint32_t len) {
+    write(buf, len, nullptr, 0);
+}
+
+bool pcap::write(const unsigned char *head, uint32_t head_len,
+    const unsigned char *tail, uint32_t tail_len, uint64_t ts_ns) {
+    uint32_t len = head_len + tail_len;
+    uint32_t rlen = ng ? pcapng::epb_len(len, comment) : sizeof(pcap_pkt_hdr) + len;
+    unsigned char *rec = ring->reserve(rlen);
+    if (rec == nullptr) {
+        drops.store(drops.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return false;
+    }
+    uint64_t ts = ts_ns ? ts_ns : timebase.now_ns();
+    if (ng) {
+        pcapng::format_epb(rec, ifid, ts, head, head_len, tail, tail_len, comment);
+    } else {
+        ph.tv_sec = ts / 1000000000UL;
+        ph.tv_nsec = ts % 1000000000UL;
+        ph.caplen = len;
+        ph.len = len;
+        memcpy(rec, &ph, sizeof(pcap_pkt_hdr));
+        memcpy(rec + sizeof(pcap_pkt_hdr), head, head_len);
+        memcpy(rec + sizeof(pcap_pkt_hdr) + head_len, tail, tail_len);
+    }
+    ring->commit();
+    return true;
+}
+
+void pcap::close() {
+    if (closed) return;
+    closed = true;
+    stopping.store(true, memory_order_release);
+    writer_tid.join();
+    if (!ng) {
+        delete file;
+    }
+    free(obuf);
+    delete ring;
+    if (drops.load() != 0) {
+        CEA_MSG("PCAP records dropped: " << drops.load());
+    }
+}
+
+void pcap::writer() {
+    while (true) {
+        // records queued before the stop request are always drained
+        bool stop = stopping.load(memory_order_acquire);
+        bool idle = true;
+        uint32_t len;
+        unsigned char *rec;
+
+        while ((rec = ring->peek(len)) != nullptr) {
+            if (olen + len > CEA_PCAP_BUF_SIZE) {
+                write_out(false);
+            }
+            memcpy(obuf + olen, rec, len);
+            olen += len;
+            ring->release();
+            idle = false;
+        }
+        if (stop) break;
+        if (idle) {
+            this_thread::sleep_for(microseconds(100));
+        }
+    }
+    write_out(true);
+}
+
+void pcap::write_out(bool final) {
+    uint64_t len = olen;
+    if (file->direct) {
+        if (final) {
+            file->disable_direct();
+        } else {
+            len &= ~(uint64_t)(CEA_PCAP_BLOCK_SIZE - 1);
+        }
+    }
+    if (len == 0) return;
+    file->append(obuf, len);
+    memmove(obuf, obuf + len, olen - len);
+    olen -= len;
+}
+
+//------------------------------------------------------------------------------
+// support for PCAP read
+//------------------------------------------------------------------------------
+
+// distance ahead of the replay position that is prefetched (64MB)
+#define CEA_REPLAY_WINDOW (64UL*1024*1024)
+
+// link type of the captures that can be replayed
+#define CEA_LINKTYPE_ETHERNET 1
+
+// Memory mapped pcap or pcapng file. Frames are served straight from the
+// mapping and the kernel is told to read ahead of the replay position and to
+// drop the pages behind it, so that large captures stream from disk. A
+// truncated or corrupt record ends the replay, the frames before it are
+// replayed
+class pcap_reader {
+public:
+    pcap_reader(string filename);
+    ~pcap_reader();
+
+    // return the next frame, wraps around to the first frame at the end
+    void next(const unsigned char *&data, uint32_t &len);
+
+    string filename;
+    string msg_prefix;
+    uint64_t nof_frames;
+
+private:
+    // parse the record at pos, returns false at the end of the file
+    bool parse(uint64_t &pos, const unsigned char *&data, uint32_t &len);
+
+    // advise the kernel when the replay position enters a new window
+    void advise(uint64_t pos);
+
+    unsigned char *map;
+    uint64_t map_size;
+    bool is_pcapng;
+    uint64_t first;
+    uint64_t cursor;
+    uint64_t window;
+};
+
+pcap_reader::pcap_reader(string filename) {
+    this->filename = filename;
+    msg_prefix = filename;
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 24) {
+        CEA_ERR_MSG("PCAP file " << filename << " cannot be opened for replay");
+        abort();
+    }
+    map_size = st.st_size;
+    map = (unsigned char*) mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        CEA_ERR_MSG("PCAP file " << filename << " cannot be mapped");
+        abort();
+    }
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    uint32_t magic = *(uint32_t*)map;
+    if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+        is_pcapng = false;
+        first = 24;
+        uint32_t linktype = *(uint32_t*)(map + 20);
+        if (linktype != CEA_LINKTYPE_ETHERNET) {
+            CEA_ERR_MSG("PCAP file " << filename << " has link type "
+                << linktype << ", only Ethernet can be replayed");
+            abort();
+        }
+    } else if (magic == 0x0A0D0D0A && *(uint32_t*)(map+8) == 0x1A2B3C4D) {
+        is_pcapng = true;
+        first = 0;
+    } else {
+        CEA_ERR_MSG("File " << filename << " is not a little endian pcap"
+            " or pcapng file");
+        abort();
+    }
+
+    // count the frames, this also validates the file before the replay
+    nof_frames = 0;
+    uint64_t pos = first;
+    const unsigned char *data;
+    uint32_t len;
+    while (parse(pos, data, len)) {
+        nof_frames++;
+    }
+    if (nof_frames == 0) {
+        CEA_ERR_MSG("PCAP file " << filename << " does not contain any frame");
+        abort();
+    }
+    cursor = first;
+    window = 0;
+    advise(cursor);
+    CEA_MSG("Replaying " << nof_frames << " frames from " << filename);
+}
+
+pcap_reader::~pcap_reader() {
+    munmap(map, map_size);
+}
+
+bool pcap_reader::parse(uint64_t &pos, const unsigned char *&data, uint32_t &len) {
+    while (true) {
+        if (!is_pcapng) {
+            if (pos + 16 > map_size) return false;
+            uint32_t caplen = *(uint32_t*)(map + pos + 8);
+            if (pos + 16 + caplen > map_size) return false;
+            data = map + pos + 16;
+            len = caplen;
+            pos += 16 + caplen;
+            return true;
+        }
+        if (pos + 12 > map_size) return false;
+        uint32_t type = *(uint32_t*)(map + pos);
+        uint32_t blen = *(uint32_t*)(map + pos + 4);
+        if (blen < 12 || pos + blen > map_size) return false;
+        uint64_t blk = pos;
+        pos += blen;
+        if (type == 0x00000006) {           // enhanced packet block
+            if (blen < 32) return false;
+            data = map + blk + 28;
+            len = min(*(uint32_t*)(map + blk + 20), blen - 32);
+            return true;
+        } else if (type == 0x00000003) {    // simple packet block
+            if (blen < 16) return false;
+            data = map + blk + 12;
+            len = min(*(uint32_t*)(map + blk + 8), blen - 16);
+            return true;
+        } else if (type == 0x00000001) {    // interface description block
+            // seen by the count of the frames before the replay starts
+            uint16_t linktype = blen < 20 ? 0 : *(uint16_t*)(map + blk + 8);
+            if (linktype != CEA_LINKTYPE_ETHERNET) {
+                CEA_ERR_MSG("PCAP file " << filename << " has an interface"
+                    " of link type " << linktype << ", only Ethernet can be"
+                    " replayed");
+                abort();
+            }
+        }
+        // skip all other blocks
+    }
+}
+
+void pcap_reader::next(const unsigned char *&data, uint32_t &len) {
+    if (!parse(cursor, data, len)) {
+        cursor = first;
+        parse(cursor, data, len);
+    }
+    if (cursor / CEA_REPLAY_WINDOW != window) {
+        advise(cursor);
+    }
+}
+
+void pcap_reader::advise(uint64_t pos) {
+    uint64_t cur = pos / CEA_REPLAY_WINDOW;
+    uint64_t ahead = (cur + 1) * CEA_REPLAY_WINDOW;
+    if (ahead < map_size) {
+        madvise(map + ahead, min(CEA_REPLAY_WINDOW, map_size - ahead), MADV_WILLNEED);
+    }
+    if (cur > 0) {
+        madvise(map + (cur - 1) * CEA_REPLAY_WINDOW, CEA_REPLAY_WINDOW, MADV_DONTNEED);
+    }
+    window = cur;
+}
+
+//------------------------------------------------------------------------------
+// Registries of ports and streams
+//------------------------------------------------------------------------------
+
+// Growable table of objects by id. Ids are handed out by an atomic counter
+// and never reused. The slots live in segments that are allocated on first
+// use and never move, so an object can be registered from any thread and a
+// lookup is two loads without a lock
+#define CEA_REGISTRY_SEG_BITS 12
+#define CEA_REGISTRY_SEG_SIZE (1U << CEA_REGISTRY_SEG_BITS)
+#define CEA_REGISTRY_SEGS 1024  // 4M ids
+
+template <typename T>
+class cea_registry {
+public:
+    cea_registry() {
+        next.store(0, memory_order_relaxed);
+        for (auto &seg : segs) {
+            seg.store(nullptr, memory_order_relaxed);
+        }
+    }
+
+    ~cea_registry() {
+        for (auto &seg : segs) {
+            delete [] seg.load();
+        }
+    }
+
+    // a new id, the object is registered with publish
+    uint32_t allocate() {
+        uint32_t id = next.fetch_add(1, memory_order_relaxed);
+        if (id >= CEA_REGISTRY_SEGS * CEA_REGISTRY_SEG_SIZE) {
+            CEA_ERR_MSG("No ids left in the registry");
+            abort();
+        }
+        return id;
+    }
+
+    // number of ids handed out so far
+    uint32_t size() const {
+        return next.load(memory_order_acquire);
+    }
+
+    // register an object, or unregister with null
+    void publish(uint32_t id, T *item) {
+        segment(id >> CEA_REGISTRY_SEG_BITS)[id & (CEA_REGISTRY_SEG_SIZE - 1)]
+            .store(item, memory_order_release);
+    }
+
+    // object with the id, null if there is none
+    T *get(uint32_t id) const {
+        if (id >= CEA_REGISTRY_SEGS * CEA_REGISTRY_SEG_SIZE) return nullptr;
+        atomic<T*> *seg = segs[id >> CEA_REGISTRY_SEG_BITS].load(memory_order_acquire);
+        if (seg == nullptr) return nullptr;
+        return seg[id & (CEA_REGISTRY_SEG_SIZE - 1)].load(memory_order_acquire);
+    }
+
+private:
+    // the segment is allocated by the first thread to get there
+    atomic<T*> *segment(uint32_t idx) {
+        atomic<T*> *seg = segs[idx].load(memory_order_acquire);
+        if (seg == nullptr) {
+            atomic<T*> *fresh = new atomic<T*>[CEA_REGISTRY_SEG_SIZE];
+            for (uint32_t slot = 0; slot < CEA_REGISTRY_SEG_SIZE; slot++) {
+                fresh[slot].store(nullptr, memory_order_relaxed);
+            }
+            if (segs[idx].compare_exchange_strong(seg, fresh,
+                memory_order_acq_rel, memory_order_acquire)) {
+                seg = fresh;
+            } else {
+                delete [] fresh;
+            }
+        }
+        return seg;
+    }
+
+    atomic<uint32_t> next;
+    atomic<atomic<T*>*> segs[CEA_REGISTRY_SEGS];
+};
+
+// CONTROLLER
+//------------------
+// Controller class
+//------------------
+// The ports and streams of the process by id. The id of a port is the proxy
+// id of the DataQ calls
+class cea_controller {
+public:
+    cea_controller(){}
+    cea_registry<cea_port> ports;
+    cea_registry<cea_stream> streams;
+    int do_mutate(int n, cea_port *p);
+    void do_receive(unsigned char *elems, int n, cea_port *p);
+};
+
+// Global controller instance for the current workstation
+cea_controller controller;
+
+//------------------------------------------------------------------------------
+// support for Rx
+//------------------------------------------------------------------------------
+
+// marks the start of a test signature ("CEAS")
+#define CEA_SIGNATURE_MAGIC 0x53414543
+
+// number of sequence numbers below the highest one seen that are tracked to
+// tell a duplicate from a reordered frame
+#define CEA_SIGNATURE_WINDOW 1024
+
+// Test signature written by the generator right after the headers of every
+// frame of a stream that has it enabled. The timestamp is in timebase ticks
+struct cea_signature {
+    uint32_t magic;
+    uint32_t stream_id;
+    uint64_t seq;
+    uint64_t tstamp;
+} __attribute__((packed));
+
+// bucket of a latency in a cea_histogram
+static inline uint32_t cea_hist_index(uint64_t v) {
+    if (v < (2UL << CEA_HIST_SUB_BITS)) return v;
+    uint32_t shift = 63 - __builtin_clzl(v) - CEA_HIST_SUB_BITS;
+    uint32_t idx = (shift << CEA_HIST_SUB_BITS) + (v >> shift);
+    return min(idx, (uint32_t) CEA_HIST_BUCKETS - 1);
+}
+
+// largest latency that falls in a bucket
+static inline uint64_t cea_hist_value(uint32_t idx) {
+    if (idx < (2U << CEA_HIST_SUB_BITS)) return idx;
+    uint32_t shift = (idx >> CEA_HIST_SUB_BITS) - 1;
+    uint64_t sub = idx - (shift << CEA_HIST_SUB_BITS);
+    return ((sub + 1) << shift) - 1;
+}
+
+void cea_histogram::merge(const cea_histogram &other) {
+    if (other.counts.empty()) return;
+    if (counts.empty()) {
+        counts.assign(CEA_HIST_BUCKETS, 0);
+    }
+    for (uint32_t idx = 0; idx < CEA_HIST_BUCKETS; idx++) {
+        counts[idx] += other.counts[idx];
+    }
+    total += other.total;
+    max = std::max(max, other.max);
+}
+
+uint64_t cea_histogram::percentile(double p) const {
+    if (total == 0) return 0;
+    uint64_t rank = ceil(total * p / 100.0);
+    uint64_t sum = 0;
+    for (uint32_t idx = 0; idx < counts.size(); idx++) {
+        sum += counts[idx];
+        if (sum >= rank && sum > 0) {
+            return std::min(cea_hist_value(idx), max);
+        }
+    }
+    return max;
+}
+
+// Per stream result of the signature analysis on a port. Written by the rx
+// thread of the port only, the latency histogram is read by snapshots
+struct cea_rx_flow {
+    uint64_t nof_frames;
+    uint64_t nof_lost;
+    uint64_t nof_dups;
+    uint64_t nof_reordered;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    uint64_t lat_sum;
+    uint64_t hist[CEA_HIST_BUCKETS];
+
+    // record a latency, a few ns without any read-modify-write
+    void record(uint64_t lat) {
+        cea_stat_block::add(hist[cea_hist_index(lat)], 1);
+        cea_stat_block::add(nof_frames, 1);
+        if (lat > lat_max) __atomic_store_n(&lat_max, lat, __ATOMIC_RELAXED);
+        if (lat < lat_min) __atomic_store_n(&lat_min, lat, __ATOMIC_RELAXED);
+        cea_stat_block::add(lat_sum, lat);
+    }
+
+    // copy the histogram while the flow is being recorded
+    void read(cea_histogram &h) const;
+
+    // one past the highest sequence number seen and the sequence numbers of
+    // the window below it that have been received
+    uint64_t next_seq;
+    uint64_t seen[CEA_SIGNATURE_WINDOW/64];
+};
+
+// Finds the signature in the received frames and accounts them to the flow of
+// their stream. A frame is lost when its sequence number is skipped, it is
+// taken back from the lost frames when it arrives late within the window. The
+// signature sits at the same offset in all frames of a stream so the offset
+// of the previous hit is tried first before the frame is searched
+class cea_rx_analyzer {
+public:
+    cea_rx_analyzer();
+    ~cea_rx_analyzer();
+    // rx_ns is the arrival of the frame in nanoseconds since the epoch
+    void inspect(const unsigned char *frame, uint32_t len, uint64_t rx_ns);
+    void report();
+
+    // flow of a stream, null until a frame of the stream is received
+    const cea_rx_flow *flow(uint32_t stream_id) const;
+
+    string msg_prefix;
+    uint64_t nof_unsigned;
+
+private:
+    bool find(const unsigned char *frame, uint32_t len, cea_signature &sig);
+    void account(cea_rx_flow &f, uint64_t seq);
+    uint32_t last_offset;
+
+    // flows by stream id, published once and never moved so that readers
+    // need no lock
+    cea_registry<cea_rx_flow> flows;
+};
+
+void cea_rx_flow::read(cea_histogram &h) const {
+    h.counts.resize(CEA_HIST_BUCKETS);
+    h.total = 0;
+    for (uint32_t idx = 0; idx < CEA_HIST_BUCKETS; idx++) {
+        h.counts[idx] = __atomic_load_n(&hist[idx], __ATOMIC_RELAXED);
+        h.total += h.counts[idx];
+    }
+    h.max = __atomic_load_n(&lat_max, __ATOMIC_RELAXED);
+}
+
+cea_rx_analyzer::cea_rx_analyzer() {
+    nof_unsigned = 0;
+    last_offset = 0;
+}
+
+cea_rx_analyzer::~cea_rx_analyzer() {
+    for (uint32_t id = 0; id < controller.streams.size(); id++) {
+        delete flows.get(id);
+    }
+}
+
+const cea_rx_flow *cea_rx_analyzer::flow(uint32_t stream_id) const {
+    return flows.get(stream_id);
+}
+
+bool cea_rx_analyzer::find(const unsigned char *frame, uint32_t len,
+    cea_signature &sig) {
+    if (len < sizeof(cea_signature)) return false;
+    uint32_t magic = CEA_SIGNATURE_MAGIC;
+    uint32_t last = len - sizeof(cea_signature);
+    uint32_t ofs = last_offset;
+    if (ofs > last || memcmp(frame + ofs, &magic, sizeof(magic)) != 0) {
+        const unsigned char *hit = (const unsigned char*) memmem(frame,
+            last + sizeof(magic), &magic, sizeof(magic));
+        if (hit == nullptr) return false;
+        ofs = hit - frame;
+    }
+    memcpy(&sig, frame + ofs, sizeof(cea_signature));
+    // a payload that happens to carry the magic names a stream that does
+    // not exist
+    if (sig.stream_id >= controller.streams.size()) return false;
+    last_offset = ofs;
+    return true;
+}
+
+void cea_rx_analyzer::account(cea_rx_flow &f, uint64_t seq) {
+    if (seq >= f.next_seq) {
+        // in order or ahead, the skipped sequence numbers are lost for now
+        uint64_t skip = seq - f.next_seq;
+        f.nof_lost += skip;
+        if (skip >= CEA_SIGNATURE_WINDOW) {
+            memset(f.seen, 0, sizeof(f.seen));
+        } else {
+            for (uint64_t n = f.next_seq; n < seq; n++) {
+                f.seen[(n / 64) % (CEA_SIGNATURE_WINDOW/64)] &= ~(1UL << (n % 64));
+            }
+        }
+        f.seen[(seq / 64) % (CEA_SIGNATURE_WINDOW/64)] |= 1UL << (seq % 64);
+        f.next_seq = seq + 1;
+    } else if (f.next_seq - seq > CEA_SIGNATURE_WINDOW) {
+        // too late to tell, assume it was counted as lost
+        f.nof_reordered++;
+        if (f.nof_lost > 0) f.nof_lost--;
+    } else {
+        uint64_t &word = f.seen[(seq / 64) % (CEA_SIGNATURE_WINDOW/64)];
+        uint64_t bit = 1UL << (seq % 64);
+        if (word & bit) {
+            f.nof_dups++;
+        } else {
+            word |= bit;
+            f.nof_reordered++;
+            f.nof_lost--;
+        }
+    }
+}
+
+void cea_rx_analyzer::inspect(const unsigned char *frame, uint32_t len,
+    uint64_t rx_ns) {
+    cea_signature sig;
+    if (!find(frame, len, sig)) {
+        nof_unsigned++;
+        return;
+    }
+    cea_rx_flow *f = flows.get(sig.stream_id);
+    if (f == nullptr) {
+        f = new cea_rx_flow();
+        f->lat_min = UINT64_MAX;
+        flows.publish(sig.stream_id, f);
+    }
+    account(*f, sig.seq);
+    // the tx stamp is a tsc value, both ends are compared on the epoch clock
+    uint64_t tx_ns = timebase.epoch_ns(sig.tstamp);
+    f->record(rx_ns > tx_ns ? rx_ns - tx_ns : 0);
+}
+
+void cea_rx_analyzer::report() {
+    for (uint32_t id = 0; id < controller.streams.size(); id++) {
+        cea_rx_flow *f = flows.get(id);
+        if (f == nullptr) continue;
+        cea_histogram h;
+        f->read(h);
+        uint64_t frames = __atomic_load_n(&f->nof_frames, __ATOMIC_RELAXED);
+        uint64_t lat_min = __atomic_load_n(&f->lat_min, __ATOMIC_RELAXED);
+        uint64_t lat_sum = __atomic_load_n(&f->lat_sum, __ATOMIC_RELAXED);
+        CEA_MSG("Stream " << id << ": " << frames << " frames, "
+            << f->nof_lost << " lost, " << f->nof_dups << " duplicated, "
+            << f->nof_reordered << " reordered, latency min/avg/max "
+            << lat_min << "/" << lat_sum / max(frames, (uint64_t) 1) << "/"
+            << h.max << " ns, p50/p99/p99.9 " << h.percentile(50) << "/"
+            << h.percentile(99) << "/" << h.percentile(99.9) << " ns");
+    }
+    if (nof_unsigned > 0) {
+        CEA_MSG(nof_unsigned << " frames without a signature");
+    }
+}
+
+// Rebuilds frames from the interface width elements received on a port. Every
+// frame is preceded by an rx_metadata element that carries its length and the
+// timestamp of its arrival. Frames are recorded into the pcapng file of the
+// port, the recording itself runs on the writer thread of the pcap. The
+// backends of the library stamp the arrival in nanoseconds since the epoch,
+// the hardware emulator stamps it on its own clock
+class cea_rx_assembler {
+public:
+    cea_rx_assembler();
+    ~cea_rx_assembler();
+
+    // interface width of the port, resets the reassembly state
+    void set_width(uint32_t width);
+
+    // consume n elements, a frame may span any number of calls
+    void receive(const unsigned char *elems, uint32_t n);
+
+    // recording of the received frames, null when disabled
+    pcap *rxpcap;
+
+    // signature analysis of the received frames, null when disabled
+    cea_rx_analyzer *analyzer;
+
+    // set by the backends whose rx timestamps are on the epoch clock. Frames
+    // of the hardware emulator are timed when they are analyzed instead
+    bool epoch_tstamps;
+
+    // counters of the thread that feeds the assembler. The errors are the
+    // elements dropped while looking for a valid rx_metadata element
+    cea_stat_block stats;
+
+private:
+    void record(const unsigned char *frame);
+
+    cea_pack_ops packer;
+    uint32_t width;
+    uint32_t meta_elems;
+
+    // staging of the metadata and of frames spanning multiple calls
+    unsigned char *buf;
+    uint32_t have;
+    uint32_t need;
+    rx_metadata meta;
+
+    // offset from the hardware clock to the unix epoch, taken at the first
+    // frame so that the capture carries the relative hardware timestamps.
+    // Zero for timestamps that are on the epoch clock already
+    bool epoch_valid;
+    uint64_t epoch;
+};
+
+cea_rx_assembler::cea_rx_assembler() {
+    rxpcap = nullptr;
+    analyzer = nullptr;
+    epoch_tstamps = false;
+    epoch_valid = false;
+    epoch = 0;
+    buf = nullptr;
+    set_width(CEA_IFWIDTH);
+}
+
+cea_rx_assembler::~cea_rx_assembler() {
+    free(buf);
+    delete analyzer;
+}
+
+void cea_rx_assembler::set_width(uint32_t width) {
+    this->width = width;
+    packer = cea_get_pack_ops(width);
+    meta_elems = packer.num_elems(CEA_FRM_METASIZE);
+    free(buf);
+    uint32_t size = (meta_elems + packer.num_elems(CEA_MAX_FRAME_SIZE)) * width;
+    buf = (unsigned char*) aligned_alloc(CEA_CACHELINE, size);
+    have = 0;
+    need = 0;
+}
+
+void cea_rx_assembler::receive(const unsigned char *elems, uint32_t n) {
+    stats.add(stats.elements, n);
+    while (n > 0) {
+        if (need == 0) {
+            // collect the metadata
+            uint32_t k = min(n, meta_elems - have);
+            memcpy(buf + have * width, elems, k * width);
+            have += k;
+            elems += k * width;
+            n -= k;
+            if (have < meta_elems) break;
+
+            memcpy(&meta, buf, sizeof(rx_metadata));
+            if (meta.id != META_ELEM || meta.len == 0
+                || meta.len > CEA_MAX_FRAME_SIZE) {
+                // not a metadata element, slide by one element and retry
+                stats.add(stats.errors, 1);
+                memmove(buf, buf + width, (meta_elems - 1) * width);
+                have--;
+                continue;
+            }
+            need = meta_elems + packer.num_elems(meta.len);
+            continue;
+        }
+
+        uint32_t k = min(n, need - have);
+        if (have == meta_elems && have + k == need) {
+            // the whole frame is in this call, record it in place
+            record(elems);
+        } else {
+            memcpy(buf + have * width, elems, k * width);
+            if (have + k == need) {
+                record(buf + meta_elems * width);
+            }
+        }
+        have += k;
+        elems += k * width;
+        n -= k;
+        if (have == need) {
+            have = 0;
+            need = 0;
+        }
+    }
+}
+
+void cea_rx_assembler::record(const unsigned char *frame) {
+    stats.add(stats.frames, 1);
+    stats.add(stats.bytes, meta.len);
+    if (analyzer) {
+        // a signature is never looked for in the FCS
+        uint32_t len = (meta.has_fcs && meta.len > CEA_FCS_LEN)
+            ? meta.len - CEA_FCS_LEN : meta.len;
+        analyzer->inspect(frame, len,
+            epoch_tstamps ? meta.rx_tstamp : timebase.now_ns());
+    }
+    if (rxpcap == nullptr) return;
+    if (!epoch_valid) {
+        epoch = epoch_tstamps ? 0 : timebase.now_ns() - meta.rx_tstamp;
+        epoch_valid = true;
+    }
+    if (!rxpcap->write(frame, meta.len, nullptr, 0, epoch + meta.rx_tstamp)) {
+        stats.add(stats.pcap_drops, 1);
+    }
+}
+
+//------------------------------------------------------------------------------
+// support for Loopback
+//------------------------------------------------------------------------------
+
+// size of the element ring between the generator and the drain (8MB)
+#define CEA_LOOPBACK_RING_SIZE (8UL*1024*1024)
+
+// number of elements handed to the rx path in one call
+#define CEA_LOOPBACK_RX_BATCH 1024
+
+// In process replacement of the hardware emulator. The generator pushes its
+// bursts into an element ring, a drain thread takes them out at the emulated
+// line rate, replaces every tx_metadata by an rx_metadata stamped with the
+// emulated arrival time and hands the frames to the rx path of the port. An
+// unpaced line runs ahead of the wall clock, its latency includes the time
+// the frames would have queued for the line
+class cea_loopback {
+public:
+    cea_loopback(string name, uint32_t width, uint64_t line_rate, bool paced,
+        cea_rx_assembler *rx, cea_stat_block *txstats);
+    ~cea_loopback();
+
+    // generator: queue n elements, waits while the ring is full
+    void put_burst(const unsigned char *elems, uint32_t n);
+
+    // generator: wait until all queued elements are drained and report
+    void finish();
+
+    string msg_prefix;
+
+private:
+    void drain();
+    void consume(const unsigned char *elems, uint32_t n);
+    void flush_rx();
+    void pace();
+
+    cea_spsc_ring *ring;
+    thread drain_tid;
+    atomic<bool> stopping;
+
+    cea_pack_ops packer;
+    uint32_t width;
+    uint32_t meta_elems;
+    cea_rx_assembler *rx;
+    cea_stat_block *txstats;
+
+    // tx to rx conversion
+    unsigned char *metabuf;
+    uint32_t meta_have;
+    uint32_t frame_left;
+    unsigned char *rxbuf;
+    uint32_t rx_count;
+
+    // emulated line, time in ns since the first element
+    bool paced;
+    long double ns_per_byte;
+    long double vclock;
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    // statistics
+    uint64_t nof_frames;
+    uint64_t nof_bytes;
+    uint64_t stall_ticks;
+    uint64_t occ_sum;
+    uint64_t occ_max;
+    uint64_t occ_samples;
+};
+
+cea_loopback::cea_loopback(string name, uint32_t width, uint64_t line_rate,
+    bool paced, cea_rx_assembler *rx, cea_stat_block *txstats) {
+    msg_prefix = name;
+    this->width = width;
+    this->paced = paced;
+    this->rx = rx;
+    this->txstats = txstats;
+    packer = cea_get_pack_ops(width);
+    meta_elems = packer.num_elems(CEA_FRM_METASIZE);
+    ns_per_byte = 8e9L / line_rate;
+
+    ring = new cea_spsc_ring(CEA_LOOPBACK_RING_SIZE);
+    metabuf = (unsigned char*) aligned_alloc(CEA_CACHELINE, meta_elems * width);
+    rxbuf = (unsigned char*) aligned_alloc(CEA_CACHELINE, CEA_LOOPBACK_RX_BATCH * width);
+    rx->epoch_tstamps = true;
+    meta_have = 0;
+    frame_left = 0;
+    rx_count = 0;
+    vclock = 0;
+    start_ns = 0;
+    end_ns = 0;
+    nof_frames = 0;
+    nof_bytes = 0;
+    stall_ticks = 0;
+    occ_sum = 0;
+    occ_max = 0;
+    occ_samples = 0;
+
+    stopping.store(false);
+    drain_tid = thread(&cea_loopback::drain, this);
+    pthread_setname_np(drain_tid.native_handle(), "loopback");
+    CEA_MSG("Loopback started at " << line_rate / 1000000 << " Mbps"
+        << (paced ? "" : " (unpaced)"));
+}
+
+cea_loopback::~cea_loopback() {
+    if (drain_tid.joinable()) {
+        finish();
+    }
+    delete ring;
+    free(metabuf);
+    free(rxbuf);
+}
+
+void cea_loopback::put_burst(const unsigned char *elems, uint32_t n) {
+    uint32_t len = n * width;
+    unsigned char *rec = ring->reserve(len);
+    if (rec == nullptr) {
+        uint64_t t0 = timebase.ticks();
+        while ((rec = ring->reserve(len)) == nullptr) {
+            this_thread::yield();
+        }
+        stall_ticks += timebase.ticks() - t0;
+        txstats->add(txstats->stalls, 1);
+    }
+    memcpy(rec, elems, len);
+    ring->commit();
+}
+
+void cea_loopback::finish() {
+    stopping.store(true, memory_order_release);
+    drain_tid.join();
+
+    long double secs = (end_ns - start_ns) / 1e9L;
+    if (secs <= 0) secs = 1e-9L;
+    CEA_MSG("Loopback: " << nof_frames << " frames, " << fixed << setprecision(3)
+        << nof_frames / secs / 1e6 << " Mpps, "
+        << nof_bytes * 8 / secs / 1e9 << " Gbps, ring occupancy avg "
+        << (occ_samples ? occ_sum * 100.0 / occ_samples / CEA_LOOPBACK_RING_SIZE : 0)
+        << "% max " << occ_max * 100.0 / CEA_LOOPBACK_RING_SIZE
+        << "%, generator stalled " << timebase.ticks_to_ns(stall_ticks) / 1e6
+        << " ms" << defaultfloat);
+}
+
+void cea_loopback::drain() {
+    while (true) {
+        // elements queued before the stop request are always drained
+        bool stop = stopping.load(memory_order_acquire);
+        bool idle = true;
+        uint32_t len;
+        unsigned char *rec;
+
+        while ((rec = ring->peek(len)) != nullptr) {
+            uint64_t occ = ring->occupancy();
+            occ_sum += occ;
+            occ_max = max(occ_max, occ);
+            occ_samples++;
+            if (start_ns == 0) {
+                start_ns = timebase.now_ns();
+            }
+            consume(rec, len / width);
+            ring->release();
+            if (paced) {
+                pace();
+            }
+            idle = false;
+        }
+        flush_rx();
+        if (!idle) {
+            end_ns = timebase.now_ns();
+        }
+        if (stop) break;
+        if (idle) {
+            this_thread::yield();
+        }
+    }
+}
+
+// hold the drain until the emulated line has caught up with the wall clock
+void cea_loopback::pace() {
+    uint64_t due = start_ns + (uint64_t) vclock;
+    uint64_t now = timebase.now_ns();
+    // counted on the rx block, which the drain writes anyway, so that the
+    // drain never writes to the cache line of the worker. read_stats moves
+    // them to the tx counters as on the other backends
+    if (now < due) {
+        rx->stats.add(rx->stats.rate_waits, 1);
+    }
+    if (now + 1000000 < due) {
+        flush_rx();
+        this_thread::sleep_for(nanoseconds(due - now - 1000000));
+    }
+    while (timebase.now_ns() < due) {
+        cea_cpu_relax();
+    }
+}
+
+void cea_loopback::consume(const unsigned char *elems, uint32_t n) {
+    while (n > 0) {
+        if (frame_left == 0) {
+            // collect the metadata
+            uint32_t k = min(n, meta_elems - meta_have);
+            memcpy(metabuf + meta_have * width, elems, k * width);
+            meta_have += k;
+            elems += k * width;
+            n -= k;
+            if (meta_have < meta_elems) break;
+            meta_have = 0;
+
+            tx_metadata *tm = (tx_metadata*) metabuf;
+            if (tm->is_dummy) {
+                vclock += tm->ipg * ns_per_byte;
+                continue;
+            }
+            // an idle line starts the frame when the frame is drained
+            long double drained = timebase.now_ns() - start_ns;
+            if (vclock < drained) {
+                vclock = drained;
+            }
+            vclock += (tm->len + CEA_PREAMBLE_LEN) * ns_per_byte;
+            if (rx_count + meta_elems > CEA_LOOPBACK_RX_BATCH) {
+                flush_rx();
+            }
+            unsigned char *dst = rxbuf + rx_count * width;
+            memset(dst, 0, meta_elems * width);
+            rx_metadata *rm = (rx_metadata*) dst;
+            rm->len = tm->len;
+            rm->has_fcs = tm->has_fcs;
+            rm->ipg = tm->ipg;
+            rm->rx_tstamp = start_ns + (uint64_t) vclock;
+            rm->id = META_ELEM;
+            rx_count += meta_elems;
+            vclock += tm->ipg * ns_per_byte;
+
+            frame_left = packer.num_elems(tm->len);
+            nof_frames++;
+            nof_bytes += tm->len;
+            continue;
+        }
+        uint32_t k = min(min(n, frame_left), CEA_LOOPBACK_RX_BATCH - rx_count);
+        if (k == 0) {
+            flush_rx();
+            continue;
+        }
+        memcpy(rxbuf + rx_count * width, elems, k * width);
+        rx_count += k;
+        frame_left -= k;
+        elems += k * width;
+        n -= k;
+    }
+}
+
+void cea_loopback::flush_rx() {
+    if (rx_count == 0) return;
+    rx->receive(rxbuf, rx_count);
+    rx_count = 0;
+}
+
+//------------------------------------------------------------------------------
+// support for AF_PACKET
+//------------------------------------------------------------------------------
+
+// the tx and rx rings are made of this many blocks of 1MB
+#define CEA_AFP_BLOCK_SIZE (1UL<<20)
+#define CEA_AFP_NOF_BLOCKS 16
+
+// frames queued in the tx ring before the kernel is kicked
+#define CEA_AFP_KICK_BATCH 256
+
+// size of the buffer used to hand received frames to the rx path (256KB)
+#define CEA_AFP_RX_BUF_SIZE 262144
+
+// Memory mapped PACKET_TX_RING and PACKET_RX_RING of a linux interface. A
+// frame is generated in place into a tx ring slot, its metadata first and
+// the frame right behind it, which the kernel is pointed at with
+// PACKET_TX_HAS_OFF. The kernel is kicked once per batch. Received frames
+// are packed into elements behind an rx_metadata stamped by the kernel and
+// handed to the rx path
+class cea_af_packet {
+public:
+    cea_af_packet(string ifname, uint32_t width, uint64_t line_rate,
+        cea_rx_assembler *rx, cea_stat_block *txstats);
+    ~cea_af_packet();
+
+    // generator: where the elements of the next frame are generated, waits
+    // while the tx ring is full. A slot holds slot_elems elements
+    unsigned char *frame_elems();
+    uint32_t slot_elems;
+
+    // generator: queue the frame of the n elements generated at frame_elems.
+    // A gap or a frame larger than the slot leaves the slot for the next one
+    void commit(uint32_t n);
+
+    // generator: kick the queued frames and wait until they are sent
+    void flush();
+
+    // stop the receiver and report
+    void close();
+
+    string msg_prefix;
+
+private:
+    tpacket2_hdr *slot(unsigned char *ring, uint32_t idx);
+    void next_tx_slot();
+    void kick();
+    void pace();
+    void receiver();
+
+    int fd;
+    unsigned char *map;
+    uint64_t map_len;
+    unsigned char *rx_ring;
+    unsigned char *tx_ring;
+    uint32_t slot_size;
+    uint32_t nof_slots;
+    uint32_t tx_idx;
+    uint32_t pending;
+
+    // layout of a tx slot, offsets of the elements and of the frame
+    cea_pack_ops packer;
+    uint32_t width;
+    uint32_t meta_elems;
+    uint32_t elem_off;
+    uint32_t data_off;
+    uint32_t max_frame_len;
+    tpacket2_hdr *frame_slot;
+
+    // emulated line
+    long double ns_per_byte;
+    long double vclock;
+    uint64_t start_ns;
+
+    cea_rx_assembler *rx;
+    cea_stat_block *txstats;
+    thread rx_tid;
+    atomic<bool> stopping;
+    bool closed;
+
+    uint64_t tx_frames;
+    uint64_t tx_oversize;
+    uint64_t tx_stall_ticks;
+    uint64_t kicks;
+    uint64_t rx_frames;
+};
+
+cea_af_packet::cea_af_packet(string ifname, uint32_t width, uint64_t line_rate,
+    cea_rx_assembler *rx, cea_stat_block *txstats) {
+    msg_prefix = ifname;
+    this->width = width;
+    this->rx = rx;
+    this->txstats = txstats;
+    // the kernel stamps the arrival on CLOCK_REALTIME
+    rx->epoch_tstamps = true;
+    packer = cea_get_pack_ops(width);
+    meta_elems = packer.num_elems(CEA_FRM_METASIZE);
+    ns_per_byte = 8e9L / line_rate;
+
+    fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        CEA_ERR_MSG("AF_PACKET socket cannot be opened: " << strerror(errno));
+        abort();
+    }
+    ifreq ifr = {};
+    strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        CEA_ERR_MSG("Interface " << ifname << " not found");
+        abort();
+    }
+    int ifindex = ifr.ifr_ifindex;
+    if (ioctl(fd, SIOCGIFMTU, &ifr) < 0) {
+        CEA_ERR_MSG("MTU of interface " << ifname << " cannot be read");
+        abort();
+    }
+
+    // a slot holds the elements of the largest frame the interface can
+    // carry, they start on the first cache line behind the slot header
+    max_frame_len = ifr.ifr_mtu + 18;
+    elem_off = (TPACKET2_HDRLEN + CEA_CACHELINE - 1) & ~(CEA_CACHELINE - 1);
+    data_off = elem_off + meta_elems * width;
+    uint32_t need = data_off + packer.num_elems(max_frame_len) * width;
+    slot_size = 2048;
+    while (slot_size < need) slot_size <<= 1;
+    slot_elems = (slot_size - elem_off) / width;
+
+    int version = TPACKET_V2;
+    tpacket_req req = {};
+    req.tp_block_size = max((uint32_t)CEA_AFP_BLOCK_SIZE, slot_size);
+    req.tp_block_nr = CEA_AFP_NOF_BLOCKS;
+    req.tp_frame_size = slot_size;
+    req.tp_frame_nr = (req.tp_block_size / slot_size) * req.tp_block_nr;
+    nof_slots = req.tp_frame_nr;
+    int one = 1;
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0
+        || setsockopt(fd, SOL_PACKET, PACKET_TX_HAS_OFF, &one, sizeof(one)) < 0
+        || setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0
+        || setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+        CEA_ERR_MSG("PACKET_MMAP rings cannot be set up: " << strerror(errno));
+        abort();
+    }
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+
+    map_len = 2UL * req.tp_block_size * req.tp_block_nr;
+    map = (unsigned char*) mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        CEA_ERR_MSG("PACKET_MMAP rings cannot be mapped: " << strerror(errno));
+        abort();
+    }
+    rx_ring = map;
+    tx_ring = map + map_len / 2;
+
+    sockaddr_ll sll = {};
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    if (bind(fd, (sockaddr*) &sll, sizeof(sll)) < 0) {
+        CEA_ERR_MSG("AF_PACKET socket cannot be bound to " << ifname
+            << ": " << strerror(errno));
+        abort();
+    }
+
+    frame_slot = nullptr;
+    tx_idx = 0;
+    pending = 0;
+    vclock = 0;
+    start_ns = 0;
+    tx_frames = 0;
+    tx_oversize = 0;
+    tx_stall_ticks = 0;
+    kicks = 0;
+    rx_frames = 0;
+    closed = false;
+
+    stopping.store(false);
+    rx_tid = thread(&cea_af_packet::receiver, this);
+    pthread_setname_np(rx_tid.native_handle(), "afp_rx");
+    CEA_MSG("AF_PACKET rings of " << nof_slots << " slots of " << slot_size
+        << " bytes mapped");
+}
+
+cea_af_packet::~cea_af_packet() {
+    close();
+    munmap(map, map_len);
+    ::close(fd);
+}
+
+tpacket2_hdr *cea_af_packet::slot(unsigned char *ring, uint32_t idx) {
+    return (tpacket2_hdr*)(ring + (uint64_t)(idx % nof_slots) * slot_size);
+}
+
+// wait for the next free tx slot, the kernel is kicked if it is holding it
+void cea_af_packet::next_tx_slot() {
+    tpacket2_hdr *hdr = slot(tx_ring, tx_idx);
+    if (hdr->tp_status != TP_STATUS_AVAILABLE) {
+        uint64_t t0 = timebase.ticks();
+        kick();
+        while (*(volatile uint32_t*)&hdr->tp_status != TP_STATUS_AVAILABLE) {
+            if (hdr->tp_status & TP_STATUS_WRONG_FORMAT) {
+                CEA_ERR_MSG("Frame rejected by the kernel");
+                abort();
+            }
+            pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, 1);
+        }
+        tx_stall_ticks += timebase.ticks() - t0;
+        txstats->add(txstats->stalls, 1);
+    }
+    frame_slot = hdr;
+}
+
+unsigned char *cea_af_packet::frame_elems() {
+    if (start_ns == 0) {
+        start_ns = timebase.now_ns();
+    }
+    if (frame_slot == nullptr) {
+        next_tx_slot();
+    }
+    return (unsigned char*) frame_slot + elem_off;
+}
+
+void cea_af_packet::commit(uint32_t n) {
+    tx_metadata *tm = (tx_metadata*)((unsigned char*) frame_slot + elem_off);
+    vclock += tm->ipg * ns_per_byte;
+    if (tm->is_dummy) return;
+    vclock += (tm->len + CEA_PREAMBLE_LEN) * ns_per_byte;
+
+    // the interface appends the FCS
+    uint32_t len = (tm->has_fcs && tm->len > CEA_FCS_LEN)
+        ? tm->len - CEA_FCS_LEN : tm->len;
+    if (n > slot_elems || len > max_frame_len) {
+        tx_oversize++;
+        return;
+    }
+    frame_slot->tp_len = len;
+    frame_slot->tp_mac = data_off;
+    __atomic_store_n(&frame_slot->tp_status, TP_STATUS_SEND_REQUEST,
+        __ATOMIC_RELEASE);
+    frame_slot = nullptr;
+    tx_idx++;
+    tx_frames++;
+    if (++pending == CEA_AFP_KICK_BATCH) {
+        pace();
+        kick();
+    }
+}
+
+void cea_af_packet::kick() {
+    if (pending == 0) return;
+    while (sendto(fd, NULL, 0, 0, NULL, 0) < 0) {
+        if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+            CEA_ERR_MSG("sendto failed: " << strerror(errno));
+            abort();
+        }
+        this_thread::yield();
+    }
+    pending = 0;
+    kicks++;
+}
+
+// hold the generator until the emulated line has caught up with the wall clock
+void cea_af_packet::pace() {
+    uint64_t due = start_ns + (uint64_t) vclock;
+    uint64_t now = timebase.now_ns();
+    if (now < due) {
+        txstats->add(txstats->rate_waits, 1);
+        this_thread::sleep_for(nanoseconds(due - now));
+    }
+}
+
+void cea_af_packet::flush() {
+    pace();
+    kick();
+    for (uint32_t idx=0; idx<nof_slots; idx++) {
+        tpacket2_hdr *hdr = slot(tx_ring, idx);
+        while (*(volatile uint32_t*)&hdr->tp_status & (TP_STATUS_SEND_REQUEST
+            | TP_STATUS_SENDING)) {
+            this_thread::sleep_for(microseconds(10));
+        }
+    }
+    long double secs = (timebase.now_ns() - start_ns) / 1e9L;
+    if (secs <= 0) secs = 1e-9L;
+    CEA_MSG("Transmitted " << tx_frames << " frames in " << kicks << " kicks, "
+        << fixed << setprecision(3) << tx_frames / secs / 1e6 << " Mpps, "
+        << tx_oversize << " oversize frames dropped, ring full for "
+        << timebase.ticks_to_ns(tx_stall_ticks) / 1e6 << " ms" << defaultfloat);
+}
+
+void cea_af_packet::close() {
+    if (closed) return;
+    closed = true;
+    stopping.store(true, memory_order_release);
+    rx_tid.join();
+    CEA_MSG("Received " << rx_frames << " frames");
+}
+
+void cea_af_packet::receiver() {
+    unsigned char *rxbuf = (unsigned char*) aligned_alloc(CEA_CACHELINE,
+        CEA_AFP_RX_BUF_SIZE);
+    uint32_t rx_count = 0;
+    uint32_t rx_idx = 0;
+
+    while (!stopping.load(memory_order_acquire)) {
+        tpacket2_hdr *hdr = slot(rx_ring, rx_idx);
+        if (!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            if (rx_count) {
+                rx->receive(rxbuf, rx_count);
+                rx_count = 0;
+            }
+            pollfd pfd = {fd, POLLIN, 0};
+            poll(&pfd, 1, 10);
+            continue;
+        }
+        sockaddr_ll *sll = (sockaddr_ll*)((unsigned char*) hdr
+            + TPACKET_ALIGN(sizeof(tpacket2_hdr)));
+        uint32_t len = hdr->tp_snaplen;
+        uint32_t nelems = meta_elems + packer.num_elems(len);
+        if (sll->sll_pkttype != PACKET_OUTGOING && len > 0) {
+            if ((rx_count + nelems) * width > CEA_AFP_RX_BUF_SIZE) {
+                rx->receive(rxbuf, rx_count);
+                rx_count = 0;
+            }
+            unsigned char *dst = rxbuf + rx_count * width;
+            memset(dst, 0, meta_elems * width);
+            rx_metadata *rm = (rx_metadata*) dst;
+            rm->len = len;
+            rm->rx_tstamp = hdr->tp_sec * 1000000000UL + hdr->tp_nsec;
+            rm->id = META_ELEM;
+            packer.pack(dst + meta_elems * width, (unsigned char*) hdr
+                + hdr->tp_mac, len, 0, nelems - meta_elems);
+            rx_count += nelems;
+            rx_frames++;
+        }
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        rx_idx = (rx_idx + 1) % nof_slots;
+    }
+    if (rx_count) {
+        rx->receive(rxbuf, rx_count);
+    }
+    free(rxbuf);
+}
+
+//------------------------------------------------------------------------------
+// support for shared memory transport
+//------------------------------------------------------------------------------
+
+// size of the element ring shared with the consumer (64MB)
+#define CEA_SHM_RING_SIZE (64UL*1024*1024)
+
+// the elements start at the second huge page so that they are page aligned
+#define CEA_SHM_HUGEPAGE_SIZE (2UL*1024*1024)
+
+// time the consumer is given to connect (30s)
+#define CEA_SHM_CONNECT_TIMEOUT_MS 30000
+
+// interval at which a waiting generator checks that the consumer is alive
+#define CEA_SHM_LIVENESS_NS 1000000
+
+// Element ring in a memfd shared with a consumer process. The memory is
+// backed by huge pages when the system has them reserved. The consumer
+// connects to a unix socket and receives the memfd as SCM_RIGHTS ancillary
+// data, after that the two sides only exchange the head and tail of the ring
+// through the control block. The port generates elements in place in the ring
+class cea_shm {
+public:
+    cea_shm(string path, uint32_t width, cea_stat_block *txstats);
+    ~cea_shm();
+
+    // wait for the consumer and pass the memory to it
+    void connect();
+
+    // wait until there is room and return where the next n elements go, n is
+    // reduced to the space that is contiguous in the ring
+    unsigned char *acquire(uint32_t &n);
+
+    // make n elements written at the last acquire visible to the consumer
+    void publish(uint32_t n);
+
+    // signal the end of the traffic and wait until the consumer has drained
+    void finish();
+
+    string msg_prefix;
+
+private:
+    // abort unless the consumer is connected or has drained the ring
+    void check_consumer();
+
+    string path;
+    int memfd;
+    int lfd;
+    int cfd;
+    unsigned char *map;
+    uint64_t map_len;
+    cea_shm_ctrl *ctrl;
+    unsigned char *data;
+    uint32_t width;
+    uint64_t capacity;
+    uint64_t tail;
+    uint64_t cached_head;
+    bool hugepages;
+
+    uint64_t nof_elems;
+    uint64_t stall_ticks;
+    cea_stat_block *txstats;
+};
+
+cea_shm::cea_shm(string path, uint32_t width, cea_stat_block *txstats) {
+    msg_prefix = path;
+    this->txstats = txstats;
+    this->path = path;
+    this->width = width;
+    capacity = CEA_SHM_RING_SIZE / width;
+    map_len = CEA_SHM_HUGEPAGE_SIZE + CEA_SHM_RING_SIZE;
+
+    // fall back to regular pages when no huge pages are reserved
+    hugepages = true;
+    memfd = memfd_create("cea_shm", MFD_CLOEXEC | MFD_HUGETLB);
+    map = (unsigned char*) MAP_FAILED;
+    if (memfd >= 0 && ftruncate(memfd, map_len) == 0) {
+        map = (unsigned char*) mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, memfd, 0);
+    }
+    if (map == MAP_FAILED) {
+        if (memfd >= 0) close(memfd);
+        hugepages = false;
+        memfd = memfd_create("cea_shm", MFD_CLOEXEC);
+        if (memfd < 0 || ftruncate(memfd, map_len) != 0) {
+            CEA_ERR_MSG("Shared memory cannot be created: " << strerror(errno));
+            abort();
+        }
+        map = (unsigned char*) mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, memfd, 0);
+        if (map == MAP_FAILED) {
+            CEA_ERR_MSG("Shared memory cannot be mapped: " << strerror(errno));
+            abort();
+        }
+    }
+
+    ctrl = (cea_shm_ctrl*) map;
+    memset(ctrl, 0, sizeof(cea_shm_ctrl));
+    ctrl->magic = CEA_SHM_MAGIC;
+    ctrl->version = 1;
+    ctrl->width = width;
+    ctrl->capacity = capacity;
+    ctrl->data_offset = CEA_SHM_HUGEPAGE_SIZE;
+    data = map + CEA_SHM_HUGEPAGE_SIZE;
+    tail = 0;
+    cached_head = 0;
+    nof_elems = 0;
+    stall_ticks = 0;
+    cfd = -1;
+
+    lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (lfd < 0 || bind(lfd, (sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(lfd, 1) < 0) {
+        CEA_ERR_MSG("Unix socket " << path << " cannot be opened: "
+            << strerror(errno));
+        abort();
+    }
+    CEA_MSG("Shared memory ring of " << capacity << " elements on "
+        << (hugepages ? "huge" : "regular") << " pages, waiting at " << path);
+}
+
+cea_shm::~cea_shm() {
+    munmap(map, map_len);
+    close(memfd);
+    if (cfd >= 0) close(cfd);
+    close(lfd);
+    unlink(path.c_str());
+}
+
+void cea_shm::connect() {
+    pollfd pfd = {lfd, POLLIN, 0};
+    if (poll(&pfd, 1, CEA_SHM_CONNECT_TIMEOUT_MS) <= 0) {
+        CEA_ERR_MSG("No consumer connected at " << path << " within "
+            << CEA_SHM_CONNECT_TIMEOUT_MS / 1000 << " s");
+        abort();
+    }
+    cfd = accept(lfd, NULL, NULL);
+    if (cfd < 0) {
+        CEA_ERR_MSG("Consumer cannot be accepted: " << strerror(errno));
+        abort();
+    }
+
+    // the payload carries the size of the memory, the fd travels as
+    // ancillary data
+    uint64_t len = map_len;
+    iovec iov = {&len, sizeof(len)};
+    char cbuf[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    if (sendmsg(cfd, &msg, 0) < 0) {
+        CEA_ERR_MSG("Shared memory cannot be passed: " << strerror(errno));
+        abort();
+    }
+    CEA_MSG("Consumer connected");
+}
+
+unsigned char *cea_shm::acquire(uint32_t &n) {
+    if (tail - cached_head == capacity) {
+        uint64_t t0 = timebase.ticks();
+        uint64_t checked = timebase.now_ns();
+        while ((cached_head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE))
+            + capacity == tail) {
+            cea_cpu_relax();
+            uint64_t now = timebase.now_ns();
+            if (now - checked > CEA_SHM_LIVENESS_NS) {
+                check_consumer();
+                checked = now;
+            }
+        }
+        stall_ticks += timebase.ticks() - t0;
+        txstats->add(txstats->stalls, 1);
+    }
+    uint64_t pos = tail & (capacity - 1);
+    n = min((uint64_t) n, min(capacity - (tail - cached_head), capacity - pos));
+    return data + pos * width;
+}
+
+void cea_shm::publish(uint32_t n) {
+    tail += n;
+    nof_elems += n;
+    __atomic_store_n(&ctrl->tail, tail, __ATOMIC_RELEASE);
+}
+
+void cea_shm::finish() {
+    __atomic_store_n(&ctrl->eos, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE) != tail) {
+        this_thread::sleep_for(microseconds(100));
+        check_consumer();
+    }
+    CEA_MSG("Shared " << nof_elems << " elements, generator waited for the"
+        << " consumer for " << timebase.ticks_to_ns(stall_ticks) / 1000000
+        << " ms");
+}
+
+void cea_shm::check_consumer() {
+    pollfd pfd = {cfd, POLLRDHUP, 0};
+    if (poll(&pfd, 1, 0) <= 0
+        || !(pfd.revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+        return;
+    }
+    // the consumer may have drained the ring just before it went away
+    uint64_t head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+    if (head == tail) return;
+    CEA_ERR_MSG("Consumer at " << path << " disconnected with " << tail - head
+        << " elements not consumed");
+    abort();
+}
+
+//------------------------------------------------------------------------------
+// support for compiled stream plans
+//------------------------------------------------------------------------------
+
+// The result of bootstrapping a stream is kept in a plan file named after a
+// hash of the configuration of the stream, so that the next start of the
+// same stream maps the file instead of parsing and building everything again.
+// The file is a cea_plan_header followed by the frame sizes, the parsed
+// generation specs of the mutable fields and their value lists, the principal
+// frame and the payload array, each 8 byte aligned
+#define CEA_PLAN_MAGIC 0x314e4c505f414543ULL // "CEA_PLN1"
+#define CEA_PLAN_VERSION 1
+
+struct cea_plan_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t hdr_len;       // bits
+    uint64_t key;
+    uint64_t file_len;
+    uint32_t nof_sizes;
+    uint32_t max_frame_size;
+    uint32_t nof_fields;    // mutable fields
+    uint32_t pf_len;        // bytes of the principal frame
+};
+
+struct cea_plan_field {
+    uint64_t value;
+    uint64_t step;
+    uint64_t min;
+    uint64_t max;
+    uint64_t count;
+    uint64_t repeat;
+    uint64_t mask;
+    uint64_t seed;
+    uint64_t start;
+    uint64_t error;
+    uint64_t nof_values;
+};
+
+// 64 bit hash of a configuration, fed a word at a time. It only has to tell
+// configurations apart, not resist collisions made on purpose
+class cea_plan_hash {
+public:
+    uint64_t value = 0xcbf29ce484222325ULL;
+
+    void add(uint64_t word) {
+        value = (value ^ word) * 0x100000001b3ULL;
+    }
+
+    // the value with all its bits mixed
+    uint64_t digest() {
+        uint64_t h = value;
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+        h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return h ^ (h >> 33);
+    }
+
+    void add(const void *data, size_t len) {
+        const unsigned char *p = (const unsigned char*) data;
+        // short strings such as addresses take a single word with their length
+        if (len < 8) {
+            uint64_t word = 0;
+            memcpy(&word, p, len);
+            add(word | ((uint64_t) len << 56));
+            return;
+        }
+        add(len);
+        for (; len >= 8; p += 8, len -= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            add(word);
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, p, len);
+        add(tail);
+    }
+
+    void add(const string &s) {
+        add(s.data(), s.size());
+    }
+
+    void add(const cea_field_mutation_spec &f) {
+        add(((uint64_t) f.defaults.id << 32) | f.defaults.len);
+        add(((uint64_t) f.defaults.merge << 32) | f.defaults.type);
+        add(f.defaults.value);
+        add(f.defaults.pattern.data(), f.defaults.pattern.size());
+        add(((uint64_t) f.mdata.is_mutable << 32) | f.gspec.gen_type);
+        const auto &n = f.gspec.nmr;
+        for (uint64_t word : {n.value, n.step, n.min, n.max, n.count, n.repeat,
+            n.mask, n.seed, n.start, (uint64_t) n.error}) {
+            add(word);
+        }
+        add(n.values.data(), n.values.size() * sizeof(uint64_t));
+        add(n.distr.size());
+        for (auto &item : n.distr) {
+            uint64_t weight;
+            memcpy(&weight, &item.second, sizeof(weight));
+            add(item.first);
+            add(weight);
+        }
+        const auto &s = f.gspec.str;
+        for (const string *str : {&s.value, &s.min, &s.max, &s.mask, &s.start}) {
+            add(*str);
+        }
+        for (uint64_t word : {s.step, s.count, s.repeat, s.seed,
+            (uint64_t) s.error}) {
+            add(word);
+        }
+        add(s.values.size());
+        for (auto &str : s.values) {
+            add(str);
+        }
+    }
+};
+
+// find_if with lambda predicate
+cea_field_mutation_spec get_field(const vector<cea_field_mutation_spec> &tbl, cea_field_id id) {
+    auto result = find_if(tbl.begin(), tbl.end(),
+        [&id](const cea_field_mutation_spec &item) {
+        return (item.defaults.id == id); });
+
+    if (result == tbl.end()) {
+        CEA_ERR_MSG("FATAL ERROR: " << "Unrecognized field id (" << id <<") passed to " << __func__);
+        abort();
+    }
+    return (*result);
+}
+
+// copy of a field for generation. The value lists of the spec are released
+// since build_runtime has turned them into the shared patterns
+cea_field_mutation_spec cea_runtime_copy(const cea_field_mutation_spec &f) {
+    cea_field_mutation_spec m = f;
+    vector<uint64_t>().swap(m.gspec.nmr.values);
+    vector<string>().swap(m.gspec.str.values);
+    return m;
+}
+
+
+// STREAMH
+//-------------
+// Stream Core
+//-------------
+
+class cea_stream::core {
+public:
+    // ctor
+    core(string name);
+
+    // dtor
+    ~core();
+
+    // Quickly set a fixed value to a property
+    void set(cea_field_id id, uint64_t value);
+
+    // Define a complete spec for the generation of a property
+    void set(cea_field_id id, cea_field_genspec spec);
+
+    // Quickly set a fixed pattern to a field of the headers
+    void set(cea_field_id id, string value);
+
+    // fields of the headers set on the stream, applied over the fields of
+    // the headers so that a header can be shared by streams and clones. A
+    // field is looked up in the first header of the stream that has it
+    vector<cea_field_override> field_overrides;
+    cea_field_override &field_override(cea_field_id id);
+
+    // copy the headers, properties and features of the stream cloned from
+    void clone_from(cea_stream *origin);
+    cea_stream *source;
+
+    // enable or disable a stream feature
+    void set(cea_stream_feature_id feature, bool mode);
+
+    // set a string valued stream feature
+    void set(cea_stream_feature_id feature, string value);
+
+    // Based on user specification of the frame, build a vector of 
+    // field ids in the sequence required by the specification
+    void collate_frame_fields();
+
+    // The addition of mpls/vlan/llc/snap affects the position of ethertype and
+    // length fields. update/insert type or len after arranging all fields in
+    // the required sequence
+    // TODO check if this is required
+    void update_ethertype_and_len();
+
+    // evaluate field length and calculate offset of all fields of this stream
+    void build_field_offsets();
+
+    // build cseq by parsing fseq and adding only mutable fields
+    void filter_mutable_fields();
+
+    // concatenate all fields reuired by the frame spec
+    uint32_t splice_frame_fields(unsigned char *buf,
+        const vector<cea_field_mutation_spec> &fields);
+
+    // build size and payload pattern arrays
+    void build_payload_arrays();
+
+    void prepare_genspec();
+    void prepare_genspec(cea_field_mutation_spec &m);
+
+    // convert a string value of a pattern field to its integer value
+    uint64_t parse_pattern(cea_field_mutation_spec &m, const string &value);
+
+    void build_runtime();
+    void build_runtime(cea_field_mutation_spec &m);
+
+    void build_principal_frame();
+
+    // splice the fields and the payload of the largest frame into pf
+    void fill_principal_frame(const vector<cea_field_mutation_spec> &fields);
+
+    // build one metadata element per distinct frame size, ipg and stream
+    // channel so that the metadata of a frame is emitted with a single copy
+    void build_meta_templates();
+
+    // process the headers and fields and prepare for generation
+    void bootstrap_stream();
+
+    // ticks spent in each stage of the last bootstrap
+    uint64_t boot_ticks[Num_Boot_Stages];
+
+    // compiled plan cache, see cea_plan_header. A stream whose frame sizes
+    // or payload are drawn from the random device is built on every start
+    // since its frames are meant to differ from run to run
+    string plan_dir;
+    bool plan_cacheable();
+    uint64_t plan_key();
+    string plan_path(uint64_t key);
+    bool load_plan(uint64_t key);
+    void save_plan(uint64_t key);
+
+    // the headers with their versions and a hash of the properties that
+    // shape the frames at the last bootstrap. A clone that matches them
+    // apart from fields of its own headers shares the sizes, the payload and
+    // the value lists of the stream and splices its own principal frame
+    vector<pair<cea_header*, uint64_t>> boot_headers;
+    vector<pair<uint32_t, uint32_t>> boot_overrides;
+    uint64_t boot_shape;
+    core *plan_source;
+    uint64_t shape_key();
+    bool share_plan();
+
+    // begin generation
+    void mutate();
+
+    // print the frame structure, mutable fields and stream properties
+    void print_stream();
+
+    // print a vector of field specs
+    void print_fields(vector<cea_field_mutation_spec> field_group);
+
+    // Factory reset of the stream core
     void reset();
 
     // Store the header pointers added to the stream
@@ -930,21 +3941,31 @@ public:
     void convert_mac_to_uca(string address, unsigned char *op);
     void convert_ipv4_to_uca(string address, unsigned char *op);
     void convert_ipv6_to_uca(string address, unsigned char *op);
-    unsigned char convert_char_to_int(string hexNumber);
-    int convert_nibble_to_int(char digit);
 
     string convert_int_to_ipv4(uint64_t ipAddress);
     uint64_t convert_string_ipv4_internal(string addr);
 
-    // pcap handle for recording
+    // pcap handle for recording, the received frames are recorded by the
+    // port the stream is added to
     pcap *txpcap;
-    pcap *rxpcap;
+    bool rx_record;
+
+    // recording into the pcapng file shared by all ports of the testbench
+    pcap *tbpcap;
+    string pcap_comment;
+
+    // frames are replayed from this file instead of the principal frame
+    pcap_reader *replay;
 
     // Prefixture to stream messages
     string stream_name;
     uint32_t stream_id;
     string msg_prefix;
 
+    // name of the port the stream is added to, empty until then. A stream is
+    // prepared for the width and rate of one port and mutated by its worker
+    string port_name;
+
     uint32_t hdr_len; // TODO check and rename to match intent
     uint32_t nof_sizes;
     uint32_t hdr_size;
@@ -953,35 +3974,117 @@ public:
     vector<uint32_t> vof_frame_sizes;
     vector<uint32_t> vof_computed_frame_sizes;
     vector<uint32_t> vof_payload_sizes;
-    unsigned char *arof_payload_data;
-    unsigned char *arof_rnd_payload_data[CEA_MAX_RND_ARRAYS];
+    uint32_t max_frame_size;
+
+    // metadata element templates and the template used by each frame size
+    tx_metadata *arof_meta_templates;
+    uint32_t nof_meta_templates;
+    vector<uint32_t> vof_meta_template_idx;
+    // payload arrays, shared with the clones that share the plan
+    shared_ptr<const unsigned char[]> arof_payload_data;
+    shared_ptr<const unsigned char[]> arof_rnd_payload_data[CEA_MAX_RND_ARRAYS];
 
     // TODO what are these
     unsigned char *payload_pattern;
     uint32_t payload_pattern_size;
 
-    // principal frame
+    // principal frame of pf_size bytes
     unsigned char *pf;
+    uint32_t pf_size;
+    void reserve_frame(uint32_t size);
     unsigned char test_buffer[512];
 
     // random
     random_device rd;
 
+    // rate control. The ipg of a frame is a linear function of its length
+    // for all units, kept as ipg = ipg_a * len + ipg_b bytes. The fraction of
+    // the ipg is carried to the next frame in 32.32 fixed point so that the
+    // long run rate is exact for any mix of frame sizes
+    void set(cea_field_id id, uint64_t value, cea_unit unit);
+    void build_rate_schedule();
+    void apply_rate_schedule();
+    uint64_t ipg_of(uint32_t len);
+
+    // fraction of the line taken by the stream on its own, and the rescaling
+    // of its ipg when it shares the line with other streams of the port
+    long double line_share();
+    void set_port_share(long double total);
+    bool clamp_min_ipg;
+    bool rate_from_bandwidth;
+    cea_unit bw_unit;
+    cea_unit ipg_unit;
+    uint64_t line_rate;
+    long double ipg_a;
+    long double ipg_b;
+    bool ipg_clamped;
+    vector<uint64_t> vof_ipg_fp;
+    uint64_t ipg_acc;
+
     // GSFM //
-    void prepare_for_mutation();
+    // cached when the elements are read back on this core, see cea_packer
+    void prepare_for_mutation(uint32_t ifwidth, uint64_t line_rate,
+        bool cached = false);
     void mutate_next_frame();
-    int mutate_enqueue(uint32_t space);
+    int mutate_enqueue(cea_txring &ring, uint32_t space, bool one_frame = false);
+    void next_frame();
+    void emit_meta(unsigned char *dst, uint32_t first, uint32_t n);
+    cea_pack_ops packer;
+    uint32_t ifwidth;
+    uint32_t meta_elems;
+    uint32_t size_idx;
+    uint32_t frame_len;
+    const unsigned char *frame_meta;
+    bool patch_ipg;
+    uint32_t frame_ipg;
+    bool patch_len;
+
+    // the first head_elems elements of a frame are taken from the principal
+    // frame and the rest from frame_data. Only a replayed frame has a tail
+    const unsigned char *frame_data;
+    uint32_t frame_head_elems;
+    uint32_t frame_head_len;
+    uint32_t replay_head_elems;
     vector<cea_field_mutation_spec> mut;
+
+    // test signature written after the headers of every frame. The payload
+    // it covers is restored in the frames that are too short for one
+    bool sig_enable;
+    uint32_t sig_offset;
+    uint64_t sig_seq;
+    bool sig_dirty;
+    unsigned char sig_cover[sizeof(cea_signature)];
+    void write_signature();
+
+    // counters of the worker thread of the port that runs the stream
+    cea_stat_block stats;
     cea_field_genspec lenspec;
 
-    uint32_t num_txns;
-    uint32_t num_txns_transmitted;
-    uint32_t offset;
+    uint64_t num_txns;
+    uint64_t num_txns_transmitted;
+    uint64_t offset;
     uint32_t num_elems;
     uint32_t num_elems_transmitted;
     bool txdone;
     bool stream_done;
     mutation_states state;
+
+    // traffic control. A pass of the stream is one burst, or endless for
+    // continuous traffic. The port decides what follows a pass from the
+    // traffic control of the stream. Gaps between passes are sent as a dummy
+    // metadata element whose ipg is the gap
+    uint32_t traffic_type;
+    uint32_t traffic_control;
+    uint32_t isg;
+    uint32_t ibg;
+    cea_unit isg_unit;
+    cea_unit ibg_unit;
+    tx_metadata gap_meta;
+    bool gap_pending;
+    bool in_gap;
+    uint32_t gap_bytes(cea_field_id id, cea_unit unit);
+    void start_pass(uint32_t gap);
+    void finish();
 };
 
 // FIELDH
@@ -1084,6 +4187,16 @@ public:
     // prefixture to header messages
     string header_name;
     string msg_prefix;
+
+    // validate and set a field of the header, or a field of the header
+    // that is set on a stream
+    void set(cea_field_mutation_spec &field, uint64_t value);
+    void set(cea_field_mutation_spec &field, string value);
+    void set(cea_field_mutation_spec &field, cea_field_genspec spec);
+
+    // number of fields set so far, a stream compares it to find out if the
+    // header has changed since the stream was bootstrapped
+    uint64_t version;
 };
 
 // PORTH
@@ -1111,11 +4224,17 @@ public:
     // set default values
     void reset();
 
+    // configure a port property
+    void set(cea_port_property_id id, uint64_t value);
+
+    // enable or disable a port feature
+    void set(cea_stream_feature_id feature, bool mode);
+
     // set when the port object is created
     string port_name;
 
     // automatically assigned when the port object is created
-    // the value of the field is set from the global variable port_id
+    // the value of the field is allocated from the port registry
     uint32_t port_id;
 
     // user's test streams will be pushed into this queue (container1)
@@ -1132,6 +4251,86 @@ public:
     void worker();
     void start_worker();
 
+    // prepare the bootstrapped streams for generation on this port
+    void prepare_streams();
+
+    // staging ring for the elements generated in response to a fill request
+    cea_txring txring;
+
+    // counters of the worker thread, the frames and bytes are those of the
+    // streams of the port
+    cea_stat_block txstats;
+    void read_stats(cea_port_stats &ps);
+
+    // line rate of the port in Mbps
+    uint64_t line_rate;
+
+    // interleaved transmission of all streams of the port. Streams are
+    // picked by deficit round robin at frame boundaries. The deficit of a
+    // stream may go negative by one frame, so a stream is picked in O(1)
+    // irrespective of its quantum and the frame sizes
+    struct drr_entry {
+        cea_stream::core *stream;
+        int64_t quantum;
+        int64_t deficit;
+    };
+    bool interleave;
+
+    // position of the current stream in streamq when not interleaved
+    uint32_t seq_idx;
+
+    // decide what follows the pass of a stream, returns 1 when the port is done
+    int next_pass(cea_stream::core *s);
+    vector<drr_entry> drr;
+    deque<uint32_t> drr_active;
+    void build_scheduler();
+    int enqueue_interleaved(uint32_t space, bool one_frame = false);
+
+    // pcapng file of the testbench and the interface id of this port in it
+    pcapng *txpcapng;
+    uint32_t txpcapng_ifid;
+
+    // receive side, frames are rebuilt from the received elements and
+    // optionally recorded into a pcapng file of the port
+    cea_rx_assembler rx;
+    pcapng *rxpcapng;
+
+    // received frames at the last analyzer report
+    uint64_t rx_reported;
+
+    // consume n elements received on the port
+    void receive(unsigned char *elems, uint32_t n);
+
+    // consumer of the generated elements
+    uint32_t backend;
+    bool loopback_paced;
+    cea_loopback *loopback;
+    string ifname;
+    cea_af_packet *afp;
+    string socket_path;
+    cea_shm *shm;
+    void run_shm();
+    void put_burst(unsigned char *elems, uint32_t n);
+    void run_loopback();
+    void run_af_packet();
+    void open_backend();
+
+    // configure a port property that takes a string
+    void set(cea_port_property_id id, string value);
+
+    // drain the rx recording and close the file
+    void close_rx();
+
+    // generate upto space elements of the current stream and hand them over
+    // to the consumer, returns 1 when the stream is done
+    int fill(uint32_t space);
+    int fill_af_packet(uint32_t space);
+
+    // generate the next frame or gap of the port, or the part of it that
+    // fits the space. mid_frame tells if the rest of a frame is pending
+    int enqueue_frame(uint32_t space);
+    bool mid_frame();
+
     // execution control
     void start();
     void stop();
@@ -1154,8 +4353,22 @@ public:
     void start(cea_port *port = NULL);
     void stop(cea_port *port = NULL);
     void pause(cea_port *port = NULL);
+    void set(cea_stream_feature_id feature, bool mode);
+    void add_pcapng_interfaces();
+    cea_stats snapshot();
+    void load(cea_testbench *tb, string fname);
+
+    // bootstrap the streams of the ports on a pool of threads, then prepare
+    // them on their ports and report the time taken by each stage
+    void bootstrap(vector<cea_port*> targets);
     vector<cea_port*> ports;
+
+    // previous snapshot, the rates are the deltas to it
+    cea_stats last;
     string msg_prefix;
+
+    // pcapng file recording the transmit side of all ports
+    pcapng *txpcapng;
 };
 
 // HEADERI
@@ -1185,6 +4398,7 @@ cea_header::core::core(cea_header_type hdr_type) {
     header_name = string("Header") + ":" + cea_header_name[hdr_type];
     msg_prefix = header_name;
     header_type = hdr_type;
+    version = 0;
     build_header_fields();
 }
 
@@ -1197,51 +4411,8 @@ void cea_header::core::set(cea_field_id id, string value) {
         return (item.defaults.id == id); });
 
     if (field != header_fields.end()) { // if field id is valid
-        // abort if field type is not a pattern
-        if (field->defaults.type == Integer) {
-            CEA_ERR_MSG("The field "
-            << cea_trim(mtable[id].defaults.name) << " accepts only integer values");
-            abort();
-        }
-        // validate input
-        switch(field->defaults.type) {
-            case Pattern_MAC: {
-                if(!regex_match(value, regex_mac)) {
-                    CEA_ERR_MSG("The value " << value << 
-                    " does not match the acceptable pattern for " 
-                    << cea_trim(mtable[id].defaults.name));
-                    abort();
-                }
-                break;
-            } 
-            case Pattern_IPv4: {
-                if(!regex_match(value, regex_ipv4)) {
-                    CEA_ERR_MSG("The value " << value << 
-                    " does not match the acceptable pattern for " 
-                    << cea_trim(mtable[id].defaults.name));
-                    abort();
-                }
-                break;
-            } 
-            case Pattern_IPv6: {
-                if(!regex_match(value, regex_ipv6)) {
-                    CEA_ERR_MSG("The value " << value << 
-                    " does not match the acceptable pattern for " 
-                    << cea_trim(mtable[id].defaults.name));
-                    abort();
-                }
-                break;
-            } 
-            default:{
-                CEA_ERR_MSG("Input validation error for the field: "
-                << cea_trim(mtable[id].defaults.name));
-                abort();
-            }
-        }
-        // accept user value
-        field->gspec.gen_type = Fixed_Value;
-        field->gspec.str.value = value;
-        field->mdata.is_mutable = true;
+        set(*field, value);
+        version++;
     } else {
         CEA_ERR_MSG("The field "
         << cea_trim(mtable[id].defaults.name) << " does not belong to the "
@@ -1250,6 +4421,50 @@ void cea_header::core::set(cea_field_id id, string value) {
     }
 }
 
+void cea_header::core::set(cea_field_mutation_spec &field, string value) {
+    cea_field_id id = field.defaults.id;
+    // abort if field type is not a pattern
+    if (field.defaults.type == Integer) {
+        CEA_ERR_MSG("The field "
+        << cea_trim(mtable[id].defaults.name) << " accepts only integer values");
+        abort();
+    }
+    // validate input
+    bool valid;
+    switch(field.defaults.type) {
+        case Pattern_MAC: {
+            uint64_t mac;
+            valid = cea_parse_mac(value, mac);
+            break;
+        } 
+        case Pattern_IPv4: {
+            uint32_t addr;
+            valid = cea_parse_ipv4(value, addr);
+            break;
+        } 
+        case Pattern_IPv6: {
+            unsigned char addr[16];
+            valid = cea_parse_ipv6(value, addr);
+            break;
+        } 
+        default:{
+            CEA_ERR_MSG("Input validation error for the field: "
+            << cea_trim(mtable[id].defaults.name));
+            abort();
+        }
+    }
+    if (!valid) {
+        CEA_ERR_MSG("The value " << value << 
+        " does not match the acceptable pattern for " 
+        << cea_trim(mtable[id].defaults.name));
+        abort();
+    }
+    // accept user value
+    field.gspec.gen_type = Fixed_Value;
+    field.gspec.str.value = value;
+    field.mdata.is_mutable = true;
+}
+
 void cea_header::core::set(cea_field_id id, uint64_t value) {
     // try to extract the field represented by id
     auto field = find_if(header_fields.begin(), header_fields.end(),
@@ -1257,16 +4472,8 @@ void cea_header::core::set(cea_field_id id, uint64_t value) {
         return (item.defaults.id == id); });
 
     if (field != header_fields.end()) { // if field id is valid
-        // abort if field type is not a integer
-        if (field->defaults.type != Integer) {
-            CEA_ERR_MSG("The field "
-            << cea_trim(mtable[id].defaults.name) << " accepts only string patterns");
-            abort();
-        }
-        // accept user value
-        field->gspec.gen_type = Fixed_Value;
-        field->gspec.nmr.value = value;
-        field->mdata.is_mutable = true;
+        set(*field, value);
+        version++;
     } else {
         CEA_ERR_MSG("The field "
         << cea_trim(mtable[id].defaults.name) << " does not belong to the "
@@ -1275,15 +4482,28 @@ void cea_header::core::set(cea_field_id id, uint64_t value) {
     }
 }
 
+void cea_header::core::set(cea_field_mutation_spec &field, uint64_t value) {
+    // abort if field type is not a integer
+    if (field.defaults.type != Integer) {
+        CEA_ERR_MSG("The field "
+        << cea_trim(mtable[field.defaults.id].defaults.name)
+        << " accepts only string patterns");
+        abort();
+    }
+    // accept user value
+    field.gspec.gen_type = Fixed_Value;
+    field.gspec.nmr.value = value;
+    field.mdata.is_mutable = true;
+}
+
 void cea_header::core::set(cea_field_id id, cea_field_genspec spec) {
     auto field = find_if(header_fields.begin(), header_fields.end(),
         [&id](const cea_field_mutation_spec &item) {
         return (item.defaults.id == id); });
 
     if (field != header_fields.end()) {
-        // TODO Is it possible to validate spec before assigning to gspec?
-        field->gspec = spec; // TODO check if vectors also get copied
-        field->mdata.is_mutable = true;
+        set(*field, spec);
+        version++;
     } else {
         CEA_ERR_MSG("The field "
         << cea_trim(mtable[id].defaults.name) << " does not belong to the "
@@ -1292,6 +4512,12 @@ void cea_header::core::set(cea_field_id id, cea_field_genspec spec) {
     }
 }
 
+void cea_header::core::set(cea_field_mutation_spec &field, cea_field_genspec spec) {
+    // TODO Is it possible to validate spec before assigning to gspec?
+    field.gspec = spec; // TODO check if vectors also get copied
+    field.mdata.is_mutable = true;
+}
+
 void cea_header::core::build_header_fields() {
     // TODO are the clear() ok in multi-reset/multi-iteration scenario?
     // TODO what if user re-configures the header fields from test and starts
@@ -1302,9 +4528,9 @@ void cea_header::core::build_header_fields() {
     // extract the list of field ids that make up this header
     field_ids_of_header = header_to_field_map[header_type];
 
+    header_fields.reserve(field_ids_of_header.size());
     for (auto id : field_ids_of_header) {
-        auto item = get_field(mtable, id);
-        header_fields.push_back(item);
+        header_fields.push_back(get_field(mtable, id));
     }
 }
 
@@ -1373,9 +4599,12 @@ void cea_field::core::set(cea_field_genspec spec) {
 
 cea_stream::cea_stream(string name) {
     impl = make_unique<core>(name); 
+    controller.streams.publish(impl->stream_id, this);
 }
 
-cea_stream::~cea_stream() = default;
+cea_stream::~cea_stream() {
+    controller.streams.publish(impl->stream_id, nullptr);
+}
 
 void cea_stream::set(cea_field_id id, uint64_t value) {
     impl->set(id, value);
@@ -1385,15 +4614,38 @@ void cea_stream::set(cea_field_id id, cea_field_genspec spec) {
     impl->set(id, spec);
 }
 
+void cea_stream::set(cea_field_id id, string value) {
+    impl->set(id, value);
+}
+
+void cea_stream::set(cea_field_id id, uint64_t value, cea_unit unit) {
+    impl->set(id, value, unit);
+}
+
 void cea_stream::set(cea_stream_feature_id feature, bool mode) {
     impl->set(feature, mode);
 }
 
+void cea_stream::set(cea_stream_feature_id feature, string value) {
+    impl->set(feature, value);
+}
+
+// without this a string literal would be converted to bool
+void cea_stream::set(cea_stream_feature_id feature, const char *value) {
+    impl->set(feature, string(value));
+}
+
 void cea_stream::add_header(cea_header *header) {
     header->impl->msg_prefix = impl->msg_prefix + "|" + header->impl->msg_prefix;
     impl->frame_headers.push_back(header);
 }
 
+cea_stream *cea_stream::clone(string name) {
+    cea_stream *copy = new cea_stream(name);
+    copy->impl->clone_from(this);
+    return copy;
+}
+
 // TODO
 void cea_stream::add_udf(cea_field *fld) {
 // remember that UDF always overlays on the frame
@@ -1402,13 +4654,16 @@ void cea_stream::add_udf(cea_field *fld) {
 
 cea_stream::core::core(string name) {
     stream_name = name;
-    stream_id = cea::stream_id;
+    stream_id = controller.streams.allocate();
     msg_prefix = stream_name + ":" + to_string(stream_id);
-    cea::stream_id++;
+    port_name = "";
     reset();
 }
 
-cea_stream::core::~core() = default;
+cea_stream::core::~core() {
+    delete [] pf;
+    free(arof_meta_templates);
+}
 
 void cea_stream::core::set(cea_field_id id, uint64_t value) {
     if (id == PAYLOAD_Pattern) {
@@ -1426,9 +4681,65 @@ void cea_stream::core::set(cea_field_id id, uint64_t value) {
         prop->gspec.nmr.value = value;
         prop->mdata.is_mutable = false;
     } else {
-        CEA_ERR_MSG("The ID " << id << " does not belong to stream properties");
-        abort();
+        auto &o = field_override(id);
+        frame_headers[o.header]->impl->set(o.spec, value);
+    }
+
+    // the last of bandwidth and ipg that is set decides the rate
+    if (id == STREAM_Bandwidth) {
+        set(id, value, Percent);
+    } else if (id == STREAM_Ipg) {
+        set(id, value, Bytes);
+    }
+}
+
+void cea_stream::core::set(cea_field_id id, uint64_t value, cea_unit unit) {
+    switch (id) {
+        case STREAM_Bandwidth: {
+            if (unit != Percent && unit != Frames_Per_Sec && unit != Bits_Per_Sec
+                && unit != Kilobits_Per_Sec && unit != Megabits_Per_Sec) {
+                CEA_ERR_MSG("Bandwidth accepts Percent, Frames_Per_Sec, "
+                    "Bits_Per_Sec, Kilobits_Per_Sec or Megabits_Per_Sec");
+                abort();
+            }
+            if (value == 0) {
+                CEA_ERR_MSG("Bandwidth cannot be zero");
+                abort();
+            }
+            rate_from_bandwidth = true;
+            bw_unit = unit;
+            break;
+            }
+        case STREAM_Ipg:
+        case STREAM_Isg:
+        case STREAM_Ibg: {
+            if (unit != Bytes && unit != Nanosecond && unit != Millisecond) {
+                CEA_ERR_MSG("The field " << cea_trim(mtable[id].defaults.name)
+                    << " accepts Bytes, Nanosecond or Millisecond");
+                abort();
+            }
+            if (id == STREAM_Ipg) {
+                rate_from_bandwidth = false;
+                ipg_unit = unit;
+            } else if (id == STREAM_Isg) {
+                isg_unit = unit;
+            } else {
+                ibg_unit = unit;
+            }
+            break;
+            }
+        default:{
+            CEA_ERR_MSG("The field " << cea_trim(mtable[id].defaults.name)
+                << " does not accept a unit");
+            abort();
+            }
     }
+    auto prop = find_if(stream_properties.begin(), stream_properties.end(),
+        [&id](const cea_field_mutation_spec &item) {
+        return (item.defaults.id == id); });
+    prop->gspec.gen_type = Fixed_Value;
+    prop->gspec.nmr.value = value;
+    prop->mdata.is_mutable = false;
 }
 
 void cea_stream::core::set(cea_field_id id, cea_field_genspec spec) {
@@ -1451,9 +4762,60 @@ void cea_stream::core::set(cea_field_id id, cea_field_genspec spec) {
             prop->mdata.is_mutable = false;
         }
     } else {
-        CEA_ERR_MSG("The ID " << id << " does not belong to stream properties");
-        abort();
+        auto &o = field_override(id);
+        frame_headers[o.header]->impl->set(o.spec, spec);
+    }
+}
+
+void cea_stream::core::set(cea_field_id id, string value) {
+    auto &o = field_override(id);
+    frame_headers[o.header]->impl->set(o.spec, value);
+}
+
+// the generation spec of an override starts empty, the value lists of the
+// header are not copied to the stream
+cea_field_override &cea_stream::core::field_override(cea_field_id id) {
+    for (uint32_t hidx=0; hidx<frame_headers.size(); hidx++) {
+        auto &ids = frame_headers[hidx]->impl->field_ids_of_header;
+        uint32_t fidx = find(ids.begin(), ids.end(), id) - ids.begin();
+        if (fidx == ids.size()) {
+            continue;
+        }
+        for (auto &o : field_overrides) {
+            if (o.header == hidx && o.field == fidx) {
+                return o;
+            }
+        }
+        const auto &f = frame_headers[hidx]->impl->header_fields[fidx];
+        cea_field_override o = {hidx, fidx, {}};
+        o.spec.defaults = f.defaults;
+        o.spec.mdata = f.mdata;
+        field_overrides.push_back(move(o));
+        return field_overrides.back();
     }
+    CEA_ERR_MSG("The field " << cea_trim(mtable[id].defaults.name)
+        << " does not belong to the properties or the headers of the stream");
+    abort();
+}
+
+// pcap recording and replay are left out since their files belong to a
+// single stream
+void cea_stream::core::clone_from(cea_stream *origin) {
+    core *src = origin->impl.get();
+    source = origin;
+    frame_headers = src->frame_headers;
+    field_overrides = src->field_overrides;
+    udfs = src->udfs;
+    stream_properties = src->stream_properties;
+    rate_from_bandwidth = src->rate_from_bandwidth;
+    bw_unit = src->bw_unit;
+    ipg_unit = src->ipg_unit;
+    isg_unit = src->isg_unit;
+    ibg_unit = src->ibg_unit;
+    sig_enable = src->sig_enable;
+    rx_record = src->rx_record;
+    pcap_comment = src->pcap_comment;
+    plan_dir = src->plan_dir;
 }
 
 void cea_stream::core::set(cea_stream_feature_id feature, bool mode) {
@@ -1465,19 +4827,53 @@ void cea_stream::core::set(cea_stream_feature_id feature, bool mode) {
             break;
             }
         case PCAP_Record_Rx_Enable: {
-            CEA_MSG("PCAP capture enabled @ Receive side");
-            string pcapfname = stream_name + "_rx" + + ".pcap";
-            rxpcap = new pcap(pcapfname, stream_name, stream_id);
+            // frames are received by a port, not by a stream
+            rx_record = mode;
+            break;
+            }
+        case Signature_Enable: {
+            sig_enable = mode;
+            break;
+            }
+        case PCAPNG_Record_Tx_Enable: {
+            CEA_ERR_MSG("PCAPNG recording is enabled on the testbench to"
+                " record all ports into one file");
+            abort();
+            }
+        default:{
+            CEA_ERR_MSG("The feature " << cea_stream_feature_name[feature]
+                << " does not accept a boolean value");
+            abort();
+            }
+    }
+}
+
+void cea_stream::core::set(cea_stream_feature_id feature, string value) {
+    switch (feature) {
+        case PCAP_Comment: {
+            pcap_comment = value;
+            break;
+            }
+        case PCAP_Replay_Source: {
+            CEA_MSG("PCAP replay enabled from " << value);
+            replay = new pcap_reader(value);
+            break;
+            }
+        case Plan_Cache_Dir: {
+            plan_dir = value;
             break;
             }
         default:{
-            // TODO error out with feature id not available and abort
+            CEA_ERR_MSG("The feature " << cea_stream_feature_name[feature]
+                << " does not accept a string value");
+            abort();
             }
     }
 }
 
 // TODO Pending verification
-uint32_t cea_stream::core::splice_frame_fields(unsigned char *buf) {
+uint32_t cea_stream::core::splice_frame_fields(unsigned char *buf,
+    const vector<cea_field_mutation_spec> &fields) {
     uint32_t offset = 0;
     uint64_t mrg_data = 0;
     uint64_t mrg_len = 0;
@@ -1485,7 +4881,7 @@ uint32_t cea_stream::core::splice_frame_fields(unsigned char *buf) {
     uint64_t mrg_cntr = 0;
     bool mrg_start = false;
 
-    for (auto f : frame_fields) {
+    for (const auto &f : fields) {
         if(f.defaults.merge==0) {
             if (f.defaults.type == Integer) {
                 // cealog << "INT Splicing: " << f.defaults.name  << "   Offset: " << offset << endl;
@@ -1524,27 +4920,388 @@ uint32_t cea_stream::core::splice_frame_fields(unsigned char *buf) {
  
 // TODO handle PROPERTIES mutation and runtime 
 void cea_stream::core::bootstrap_stream() {
+    memset(boot_ticks, 0, sizeof(boot_ticks));
+    uint64_t ticks = timebase.ticks();
+    // account the ticks since the previous stage to a stage
+    auto stage = [&](cea_boot_stage id) {
+        uint64_t now = timebase.ticks();
+        boot_ticks[id] += now - ticks;
+        ticks = now;
+    };
+    auto booted = [&]() {
+        boot_headers.clear();
+        for (auto hdr : frame_headers) {
+            boot_headers.push_back({hdr, hdr->impl->version});
+        }
+        boot_overrides.clear();
+        for (auto &o : field_overrides) {
+            boot_overrides.push_back({o.header, o.field});
+        }
+        boot_shape = shape_key();
+    };
+
+    if (source) {
+        bool shared = share_plan();
+        stage(BOOT_Share_Plan);
+        if (shared) {
+            booted();
+            return;
+        }
+    }
+    plan_source = nullptr;
+    reserve_frame(CEA_PF_SIZE);
+
     collate_frame_fields();
     update_ethertype_and_len();
+    stage(BOOT_Collate_Fields);
     build_field_offsets();
+    stage(BOOT_Field_Offsets);
     filter_mutable_fields();
+    stage(BOOT_Mutable_Fields);
+
+    bool cached = !plan_dir.empty() && plan_cacheable();
+    uint64_t key = cached ? plan_key() : 0;
+    bool loaded = cached && load_plan(key);
+    stage(BOOT_Plan_Load);
+    if (loaded) {
+        build_runtime();
+        stage(BOOT_Runtime);
+        build_meta_templates();
+        stage(BOOT_Meta_Templates);
+        booted();
+        return;
+    }
+
     prepare_genspec();
+    stage(BOOT_Genspec);
     build_runtime();
+    stage(BOOT_Runtime);
     // print_stream();
     build_payload_arrays();
+    stage(BOOT_Payload_Arrays);
+    build_meta_templates();
+    stage(BOOT_Meta_Templates);
     build_principal_frame();
+    stage(BOOT_Principal_Frame);
+    if (cached) {
+        save_plan(key);
+        stage(BOOT_Plan_Save);
+    }
+    booted();
+}
+
+uint64_t cea_stream::core::shape_key() {
+    cea_plan_hash h;
+    h.add(get_field(stream_properties, FRAME_Len));
+    h.add(get_field(stream_properties, PAYLOAD_Pattern));
+    return h.digest();
+}
+
+bool cea_stream::core::share_plan() {
+    core *base = source->impl.get();
+    while (base->plan_source) {
+        base = base->plan_source;
+    }
+    if (replay || base->boot_headers.size() != frame_headers.size()
+        || base->boot_headers.empty() || base->boot_shape != shape_key()) {
+        return false;
+    }
+
+    // the clone must have the headers of the base and set the fields the base
+    // has set, since those are built into the plan of the base
+    vector<uint32_t> first_field;
+    uint32_t pos = 0;
+    for (uint32_t idx=0; idx<frame_headers.size(); idx++) {
+        cea_header *hdr = base->boot_headers[idx].first;
+        if (frame_headers[idx] != hdr
+            || hdr->impl->version != base->boot_headers[idx].second) {
+            return false;
+        }
+        first_field.push_back(pos);
+        pos += hdr->impl->header_fields.size();
+    }
+    if (pos != base->frame_fields.size()) {
+        return false;
+    }
+    for (auto &b : base->boot_overrides) {
+        auto it = find_if(field_overrides.begin(), field_overrides.end(),
+            [&b](const cea_field_override &o) {
+            return (o.header == b.first && o.field == b.second); });
+        if (it == field_overrides.end()) {
+            return false;
+        }
+    }
+
+    hdr_len = base->hdr_len;
+    nof_sizes = base->nof_sizes;
+    max_frame_size = base->max_frame_size;
+    vof_frame_sizes = base->vof_frame_sizes;
+    vof_computed_frame_sizes = base->vof_computed_frame_sizes;
+    vof_payload_sizes = base->vof_payload_sizes;
+    arof_payload_data = base->arof_payload_data;
+    copy(begin(base->arof_rnd_payload_data), end(base->arof_rnd_payload_data),
+        begin(arof_rnd_payload_data));
+
+    mutable_fields.clear();
+    mutable_fields.reserve(base->mutable_fields.size() + field_overrides.size());
+    for (auto &f : base->mutable_fields) {
+        mutable_fields.push_back(cea_runtime_copy(f));
+        // with a seed of 0 the clone draws its own random values
+        auto &m = mutable_fields.back();
+        if (m.gspec.gen_type == Random || m.gspec.gen_type == Random_In_Range) {
+            build_runtime(m);
+        }
+    }
+    for (auto &o : field_overrides) {
+        const cea_field_mutation_spec &f =
+            base->frame_fields[first_field[o.header] + o.field];
+        cea_field_mutation_spec m;
+        m.defaults = f.defaults;
+        m.gspec = o.spec.gspec;
+        m.mdata = f.mdata;
+        m.mdata.is_mutable = true;
+        prepare_genspec(m);
+        build_runtime(m);
+        auto it = find_if(mutable_fields.begin(), mutable_fields.end(),
+            [&m](const cea_field_mutation_spec &item) {
+            return (item.mdata.offset == m.mdata.offset
+                && item.defaults.id == m.defaults.id); });
+        if (it != mutable_fields.end()) {
+            *it = move(m);
+        } else {
+            mutable_fields.push_back(move(m));
+        }
+    }
+    // mutated in the order of the frame as when built from the headers
+    stable_sort(mutable_fields.begin(), mutable_fields.end(),
+        [](const cea_field_mutation_spec &a, const cea_field_mutation_spec &b) {
+        return a.mdata.offset < b.mdata.offset; });
+
+    reserve_frame(min((uint32_t) CEA_PF_SIZE, hdr_len/8 + max_frame_size));
+    fill_principal_frame(base->frame_fields);
+    build_meta_templates();
+    plan_source = base;
+    CEA_DBG("Sharing the plan of " << base->msg_prefix << " with "
+        << field_overrides.size() << " fields set");
+    return true;
+}
+
+void cea_stream::core::reserve_frame(uint32_t size) {
+    if (pf_size < size) {
+        delete [] pf;
+        pf = new unsigned char [size];
+        pf_size = size;
+    }
+}
+
+bool cea_stream::core::plan_cacheable() {
+    auto lenspec = (get_field(stream_properties, FRAME_Len)).gspec;
+    auto plspec = (get_field(stream_properties, PAYLOAD_Pattern)).gspec;
+    bool rnd_sizes = (lenspec.gen_type == Random
+        || lenspec.gen_type == Weighted_Distribution);
+    return !(rnd_sizes && lenspec.nmr.seed == 0) && plspec.gen_type != Random;
+}
+
+uint64_t cea_stream::core::plan_key() {
+    cea_plan_hash h;
+    h.add(CEA_PLAN_VERSION);
+    h.add(CEA_MAX_FRAME_SIZE);
+    h.add(frame_fields.size());
+    for (auto &f : frame_fields) {
+        h.add(f);
+    }
+    for (auto &f : mutable_fields) {
+        h.add(f);
+    }
+    for (auto &f : stream_properties) {
+        h.add(f);
+    }
+    return h.digest();
+}
+
+string cea_stream::core::plan_path(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016lx.plan", key);
+    return plan_dir + name;
+}
+
+bool cea_stream::core::load_plan(uint64_t key) {
+    string path = plan_path(key);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(cea_plan_header)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // the payload and the value lists are used in place, so the mapping is
+    // kept for as long as the stream or one of its clones refers to them
+    size_t map_len = st.st_size;
+    shared_ptr<const unsigned char> mapping((const unsigned char*) map,
+        [map_len](const unsigned char *m) { munmap((void*) m, map_len); });
+    const unsigned char *base = mapping.get();
+    const unsigned char *end = base + map_len;
+    const unsigned char *p = base + sizeof(cea_plan_header);
+    // next section of the file, null if the file is too short
+    auto take = [&](size_t len) -> const unsigned char* {
+        const unsigned char *section = p;
+        size_t padded = (len + 7) & ~7UL;
+        if ((size_t) (end - p) < padded) return nullptr;
+        p += padded;
+        return section;
+    };
+
+    const cea_plan_header *hdr = (const cea_plan_header*) base;
+    bool valid = hdr->magic == CEA_PLAN_MAGIC
+        && hdr->version == CEA_PLAN_VERSION
+        && hdr->key == key
+        && hdr->file_len == (uint64_t) st.st_size
+        && hdr->hdr_len == hdr_len
+        && hdr->nof_fields == mutable_fields.size()
+        && hdr->nof_sizes > 0;
+
+    const uint32_t *sizes = nullptr;
+    const cea_plan_field *fields = nullptr;
+    if (valid) {
+        sizes = (const uint32_t*) take(hdr->nof_sizes * sizeof(uint32_t));
+        fields = (const cea_plan_field*)
+            take(hdr->nof_fields * sizeof(cea_plan_field));
+        valid = sizes && fields;
+    }
+    vector<const uint64_t*> values(valid ? hdr->nof_fields : 0);
+    for (uint32_t idx = 0; valid && idx < hdr->nof_fields; idx++) {
+        values[idx] = (const uint64_t*)
+            take(fields[idx].nof_values * sizeof(uint64_t));
+        valid = (values[idx] != nullptr);
+    }
+    const unsigned char *frame = valid ? take(hdr->pf_len) : nullptr;
+    const unsigned char *payload = frame ? take(CEA_MAX_FRAME_SIZE) : nullptr;
+    if (!payload || hdr->pf_len > CEA_PF_SIZE) {
+        CEA_MSG("Ignoring the invalid plan " << path);
+        return false;
+    }
+
+    // size schedule
+    nof_sizes = hdr->nof_sizes;
+    max_frame_size = hdr->max_frame_size;
+    vof_frame_sizes.assign(sizes, sizes + nof_sizes);
+    vof_computed_frame_sizes.resize(nof_sizes);
+    vof_payload_sizes.resize(nof_sizes);
+    for (uint32_t idx = 0; idx < nof_sizes; idx++) {
+        vof_computed_frame_sizes[idx] = vof_frame_sizes[idx] + meta_size;
+        vof_payload_sizes[idx] = vof_frame_sizes[idx] - (hdr_size - meta_size) - crc_len;
+    }
+
+    // generation specs as left by prepare_genspec
+    for (uint32_t idx = 0; idx < hdr->nof_fields; idx++) {
+        auto &nmr = mutable_fields[idx].gspec.nmr;
+        const cea_plan_field &f = fields[idx];
+        nmr.value = f.value;
+        nmr.step = f.step;
+        nmr.min = f.min;
+        nmr.max = f.max;
+        nmr.count = f.count;
+        nmr.repeat = f.repeat;
+        nmr.mask = f.mask;
+        nmr.seed = f.seed;
+        nmr.start = f.start;
+        nmr.error = f.error;
+        vector<uint64_t>().swap(nmr.values);
+        auto &rt = mutable_fields[idx].rt;
+        rt.patterns = shared_ptr<const uint64_t>(mapping, values[idx]);
+        rt.nof_patterns = f.nof_values;
+    }
+
+    arof_payload_data = shared_ptr<const unsigned char[]>(mapping, payload);
+    // the principal frame is mutated by generation, so it is the only copy
+    memcpy(pf, frame, hdr->pf_len);
+
+    CEA_DBG("Plan loaded from " << path << " (" << map_len << " bytes)");
+    return true;
+}
+
+void cea_stream::core::save_plan(uint64_t key) {
+    vector<unsigned char> buf(sizeof(cea_plan_header));
+    auto append = [&buf](const void *data, size_t len) {
+        const unsigned char *p = (const unsigned char*) data;
+        buf.insert(buf.end(), p, p + len);
+        buf.resize((buf.size() + 7) & ~7UL);
+    };
+
+    cea_plan_header hdr = {};
+    hdr.magic = CEA_PLAN_MAGIC;
+    hdr.version = CEA_PLAN_VERSION;
+    hdr.hdr_len = hdr_len;
+    hdr.key = key;
+    hdr.nof_sizes = nof_sizes;
+    hdr.max_frame_size = max_frame_size;
+    hdr.nof_fields = mutable_fields.size();
+    hdr.pf_len = hdr_len/8 + min(max_frame_size, (uint32_t) CEA_MAX_FRAME_SIZE);
+
+    append(vof_frame_sizes.data(), nof_sizes * sizeof(uint32_t));
+    for (auto &m : mutable_fields) {
+        auto &nmr = m.gspec.nmr;
+        cea_plan_field f = {nmr.value, nmr.step, nmr.min, nmr.max, nmr.count,
+            nmr.repeat, nmr.mask, nmr.seed, nmr.start, nmr.error,
+            nmr.values.size()};
+        append(&f, sizeof(f));
+    }
+    for (auto &m : mutable_fields) {
+        append(m.gspec.nmr.values.data(),
+            m.gspec.nmr.values.size() * sizeof(uint64_t));
+    }
+    append(pf, hdr.pf_len);
+    append(arof_payload_data.get(), CEA_MAX_FRAME_SIZE);
+    hdr.file_len = buf.size();
+    memcpy(buf.data(), &hdr, sizeof(hdr));
+
+    // written aside and renamed so that a reader never maps a partial plan
+    string path = plan_path(key);
+    string tmp = path + "." + to_string(getpid()) + "." + to_string(stream_id);
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool saved = (fd >= 0)
+        && (write(fd, buf.data(), buf.size()) == (ssize_t) buf.size());
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (saved && rename(tmp.c_str(), path.c_str()) == 0) {
+        CEA_DBG("Plan saved to " << path);
+    } else {
+        int err = errno;
+        unlink(tmp.c_str());
+        CEA_MSG("Cannot save the plan " << path << ": " << strerror(err));
+    }
 }
 
 // TODO display warning (why?) when frame headers are empty
 void cea_stream::core::collate_frame_fields() {
     frame_fields.clear();
+    size_t nof_fields = 0;
+    for (auto f : frame_headers) {
+        nof_fields += f->impl->header_fields.size();
+    }
+    frame_fields.reserve(nof_fields);
+    vector<uint32_t> first_field;
     for (auto f : frame_headers) {
+        first_field.push_back(frame_fields.size());
         frame_fields.insert(
             frame_fields.end(),
             f->impl->header_fields.begin(),
             f->impl->header_fields.end()
         );
     }
+    for (auto &o : field_overrides) {
+        auto &f = frame_fields[first_field[o.header] + o.field];
+        f.gspec = o.spec.gspec;
+        f.mdata.is_mutable = o.spec.mdata.is_mutable;
+    }
 }
  
 // TODO pending implementation
@@ -1557,7 +5314,7 @@ void cea_stream::core::build_field_offsets() {
     
     it = frame_fields.begin();
     it->mdata.offset = 0;
-    hdr_len = hdr_len + it->defaults.len;
+    hdr_len = it->defaults.len;
 
     // for(it=frame_fields.begin(); it<frame_fields.end(); it++) {
     for(it=frame_fields.begin()+1; it<frame_fields.end(); it++) {
@@ -1573,11 +5330,19 @@ void cea_stream::core::build_field_offsets() {
 }
 
 // TODO display info about the mutable fields
+// the generation specs of the mutable fields are moved out of the frame
+// fields, which keep the defaults and offsets needed to splice the frame
 void cea_stream::core::filter_mutable_fields() {
     mutable_fields.clear();
-    for (auto f : frame_fields) {
+    for (auto &f : frame_fields) {
         if (f.mdata.is_mutable) {
-            mutable_fields.push_back(f);
+            cea_field_mutation_spec m;
+            m.defaults = f.defaults;
+            m.gspec = move(f.gspec);
+            m.rt = f.rt;
+            m.mdata = f.mdata;
+            m.rnd = f.rnd;
+            mutable_fields.push_back(move(m));
         }
     }
 }
@@ -1688,7 +5453,15 @@ void cea_stream::core::build_payload_arrays() {
             //     rnd.engine.seed(rd());
             // }
             // uint32_t szidx=0;
-            for (uint32_t szidx=spec.nmr.min; szidx>spec.nmr.max; szidx++) {
+            if (spec.nmr.seed != 0) {
+                rnd.engine.seed(spec.nmr.seed);
+            } else {
+                rnd.engine.seed(rd());
+            }
+            uniform_int_distribution<uint64_t>::param_type
+                param(spec.nmr.min, spec.nmr.max);
+            rnd.ud.param(param);
+            for (uint32_t szidx=0; szidx<nof_sizes; szidx++) {
                 vof_frame_sizes[szidx] = rnd.ud(rnd.engine);
                 vof_computed_frame_sizes[szidx] = vof_frame_sizes[szidx] + meta_size;
                 vof_payload_sizes[szidx] = vof_frame_sizes[szidx] - (hdr_size - meta_size) - crc_len;
@@ -1701,8 +5474,24 @@ void cea_stream::core::build_payload_arrays() {
             vof_computed_frame_sizes.resize(nof_sizes);
             vof_payload_sizes.resize(nof_sizes);
             // uint32_t szidx=0;
-            for (uint32_t szidx=0; szidx>nof_sizes; szidx++) {
-                vof_frame_sizes[szidx] = rnd.wd(rnd.engine);
+            if (spec.nmr.distr.empty()) {
+                CEA_ERR_MSG("No distribution specified for Frame Length");
+                abort();
+            }
+            if (spec.nmr.seed != 0) {
+                rnd.engine.seed(spec.nmr.seed);
+            } else {
+                rnd.engine.seed(rd());
+            }
+            for (auto item : spec.nmr.distr) {
+                rnd.wd_lenghts.push_back(item.first);
+                rnd.wd_weights.push_back(item.second);
+            }
+            discrete_distribution<uint64_t>::param_type
+                param(rnd.wd_weights.begin(), rnd.wd_weights.end());
+            rnd.wd.param(param);
+            for (uint32_t szidx=0; szidx<nof_sizes; szidx++) {
+                vof_frame_sizes[szidx] = rnd.wd_lenghts[rnd.wd(rnd.engine)];
                 vof_computed_frame_sizes[szidx] = vof_frame_sizes[szidx] + meta_size;
                 vof_payload_sizes[szidx] = vof_frame_sizes[szidx] - (hdr_size - meta_size) - crc_len;
             }
@@ -1714,10 +5503,13 @@ void cea_stream::core::build_payload_arrays() {
             }
     }
     
+    max_frame_size = *max_element(vof_frame_sizes.begin(), vof_frame_sizes.end());
+
     //---------------
     // payload array
     //---------------
-    arof_payload_data = new unsigned char[CEA_MAX_FRAME_SIZE];
+    // built here and then shared read only
+    unsigned char *payload = new unsigned char[CEA_MAX_FRAME_SIZE];
     // auto pl_item = get_field(stream_properties, PAYLOAD_Pattern);
     // cea_field_genspec plspec = pl_item.gspec;
 
@@ -1730,11 +5522,12 @@ void cea_stream::core::build_payload_arrays() {
             srand(time(NULL));
             for (uint32_t idx=0; idx<CEA_MAX_RND_ARRAYS; idx++) {
                 uint32_t array_size = CEA_MAX_FRAME_SIZE + CEA_RND_ARRAY_SIZE;
-                arof_rnd_payload_data[idx] = new unsigned char[array_size];
+                unsigned char *rnd_data = new unsigned char[array_size];
                 for(uint32_t offset=0; offset<array_size; offset++) {
                     int num = rand()%255;
-                    memcpy(arof_rnd_payload_data[idx]+offset, (unsigned char*)&num, 1);
+                    memcpy(rnd_data+offset, (unsigned char*)&num, 1);
                 }
+                arof_rnd_payload_data[idx].reset(rnd_data);
             }
             break;
             }
@@ -1749,12 +5542,12 @@ void cea_stream::core::build_payload_arrays() {
 
             if (plspec.str.repeat) {
                 for (uint32_t cnt=0; cnt<quotient; cnt++) {
-                    memcpy(arof_payload_data+offset, payload_pattern, payload_pattern_size);
+                    memcpy(payload+offset, payload_pattern, payload_pattern_size);
                     offset += payload_pattern_size;
                 }
-                memcpy(arof_payload_data+offset, payload_pattern, remainder);
+                memcpy(payload+offset, payload_pattern, remainder);
             } else {
-                memcpy(arof_payload_data+offset, payload_pattern, payload_pattern_size);
+                memcpy(payload+offset, payload_pattern, payload_pattern_size);
             }
             delete [] payload_pattern;
             break;
@@ -1763,7 +5556,7 @@ void cea_stream::core::build_payload_arrays() {
             uint32_t offset = 0;
             for (uint32_t idx=0; idx<CEA_MAX_FRAME_SIZE/256; idx++) {
                 for (uint16_t val=0; val<256; val++) {
-                    memcpy(arof_payload_data+offset, (char*)&val, 1);
+                    memcpy(payload+offset, (char*)&val, 1);
                     offset++;
                 }
             }
@@ -1772,7 +5565,7 @@ void cea_stream::core::build_payload_arrays() {
         case Increment_Word: {
             uint32_t offset = 0;
             for (uint32_t idx=0; idx<CEA_MAX_FRAME_SIZE/2; idx++) {
-                cea_memcpy_ntw_byte_order(arof_payload_data+offset, (char*)&idx, 2);
+                cea_memcpy_ntw_byte_order(payload+offset, (char*)&idx, 2);
                 offset += 2;
             }
             break;
@@ -1781,7 +5574,7 @@ void cea_stream::core::build_payload_arrays() {
             uint32_t offset = 0;
             for (uint32_t idx=0; idx<CEA_MAX_FRAME_SIZE/256; idx++) {
                 for (int16_t val=255; val>=0; val--) {
-                    memcpy(arof_payload_data+offset, (char*)&val, 1);
+                    memcpy(payload+offset, (char*)&val, 1);
                     offset++;
                 }
             }
@@ -1790,7 +5583,7 @@ void cea_stream::core::build_payload_arrays() {
         case Decrement_Word: {
             uint32_t offset = 0;
             for (uint32_t val=0xFFFF; val>=0; val--) {
-                memcpy(arof_payload_data+offset, (char*)&val, 2);
+                memcpy(payload+offset, (char*)&val, 2);
                 offset += 2;
                 if (offset > CEA_MAX_FRAME_SIZE) break;
             }
@@ -1802,241 +5595,255 @@ void cea_stream::core::build_payload_arrays() {
             // TODO exit or abort
             }
     }
+    arof_payload_data.reset(payload);
 }
 
 void cea_stream::core::prepare_genspec() {
     for (auto &m : mutable_fields) {
-        switch (m.defaults.type) {
-            case Pattern_MAC: {
-                m.gspec.nmr.step = m.gspec.str.step;
-                m.gspec.nmr.count = m.gspec.str.count;
-                m.gspec.nmr.repeat = m.gspec.str.repeat;
-                m.gspec.nmr.seed = m.gspec.str.seed;
-                m.gspec.nmr.error = m.gspec.str.error;
-
-                uint64_t tmp_mac;
-                string tmp_mac_string;
-
-                if (m.gspec.str.value.size() > 0) {
-                    tmp_mac_string = m.gspec.str.value;
-                    tmp_mac_string.erase(remove(tmp_mac_string.begin(), tmp_mac_string.end(), ':'), tmp_mac_string.end());
-                    tmp_mac = stoul(tmp_mac_string, 0, 16);
-                    m.gspec.nmr.value = tmp_mac;
-                }
-
-                if (m.gspec.str.min.size() > 0) {
-                    tmp_mac_string = m.gspec.str.min;
-                    tmp_mac_string.erase(remove(tmp_mac_string.begin(), tmp_mac_string.end(), ':'), tmp_mac_string.end());
-                    tmp_mac = stol(tmp_mac_string, 0, 16);
-                    m.gspec.nmr.min = tmp_mac;
-                }
-
-                if (m.gspec.str.max.size() > 0) {
-                    tmp_mac_string = m.gspec.str.max;
-                    tmp_mac_string.erase(remove(tmp_mac_string.begin(), tmp_mac_string.end(), ':'), tmp_mac_string.end());
-                    tmp_mac = stol(tmp_mac_string, 0, 16);
-                    m.gspec.nmr.max = tmp_mac;
-                }
-
-                if (m.gspec.str.mask.size() > 0) {
-                    tmp_mac_string = m.gspec.str.mask;
-                    tmp_mac_string.erase(remove(tmp_mac_string.begin(), tmp_mac_string.end(), ':'), tmp_mac_string.end());
-                    tmp_mac = stol(tmp_mac_string, 0, 16);
-                    m.gspec.nmr.mask = tmp_mac;
-                }
-
-                if (m.gspec.str.start.size() > 0) {
-                    tmp_mac_string = m.gspec.str.start;
-                    tmp_mac_string.erase(remove(tmp_mac_string.begin(), tmp_mac_string.end(), ':'), tmp_mac_string.end());
-                    tmp_mac = stol(tmp_mac_string, 0, 16);
-                    m.gspec.nmr.start = tmp_mac;
-                }
-
-                for (uint32_t idx=0; idx<m.gspec.str.values.size(); idx++) {
-                    if (m.gspec.str.values[idx].size() > 0) {
-                        tmp_mac_string = m.gspec.str.values[idx];
-                        tmp_mac_string.erase(remove(tmp_mac_string.begin(), tmp_mac_string.end(), ':'), tmp_mac_string.end());
-                        tmp_mac = stol(tmp_mac_string, 0, 16);
-                        m.gspec.nmr.values.push_back(tmp_mac);
-                    }
-                }
-                break;
-                }
-            case Pattern_IPv4: {
-                m.gspec.nmr.step = m.gspec.str.step;
-                m.gspec.nmr.count = m.gspec.str.count;
-                m.gspec.nmr.repeat = m.gspec.str.repeat;
-                m.gspec.nmr.seed = m.gspec.str.seed;
-                m.gspec.nmr.error = m.gspec.str.error;
-
-                string tmp_ipv4_string;
-                uint64_t tmp_ipv4;
-
-                if (m.gspec.str.value.size() > 0) {
-                    tmp_ipv4_string = m.gspec.str.value;
-                    tmp_ipv4 = convert_string_ipv4_internal(tmp_ipv4_string);
-                    m.gspec.nmr.value = tmp_ipv4;
-                }
-
-                if (m.gspec.str.min.size() > 0) {
-                    tmp_ipv4_string = m.gspec.str.min;
-                    tmp_ipv4 = convert_string_ipv4_internal(tmp_ipv4_string);
-                    m.gspec.nmr.min = tmp_ipv4;
-                }
-
-                if (m.gspec.str.max.size() > 0) {
-                    tmp_ipv4_string = m.gspec.str.max;
-                    tmp_ipv4 = convert_string_ipv4_internal(tmp_ipv4_string);
-                    m.gspec.nmr.max = tmp_ipv4;
-                }
-
-                if (m.gspec.str.mask.size() > 0) {
-                    tmp_ipv4_string = m.gspec.str.mask;
-                    tmp_ipv4 = convert_string_ipv4_internal(tmp_ipv4_string);
-                    m.gspec.nmr.mask = tmp_ipv4;
-                }
+        prepare_genspec(m);
+    }
+}
 
-                if (m.gspec.str.start.size() > 0) {
-                    tmp_ipv4_string = m.gspec.str.start;
-                    tmp_ipv4 = convert_string_ipv4_internal(tmp_ipv4_string);
-                    m.gspec.nmr.start = tmp_ipv4;
+void cea_stream::core::prepare_genspec(cea_field_mutation_spec &m) {
+    switch (m.defaults.type) {
+        case Pattern_MAC:
+        case Pattern_IPv4: {
+            m.gspec.nmr.step = m.gspec.str.step;
+            m.gspec.nmr.count = m.gspec.str.count;
+            m.gspec.nmr.repeat = m.gspec.str.repeat;
+            m.gspec.nmr.seed = m.gspec.str.seed;
+            m.gspec.nmr.error = m.gspec.str.error;
+
+            if (m.gspec.str.value.size() > 0) {
+                m.gspec.nmr.value = parse_pattern(m, m.gspec.str.value);
+            }
+            if (m.gspec.str.min.size() > 0) {
+                m.gspec.nmr.min = parse_pattern(m, m.gspec.str.min);
+            }
+            if (m.gspec.str.max.size() > 0) {
+                m.gspec.nmr.max = parse_pattern(m, m.gspec.str.max);
+            }
+            if (m.gspec.str.mask.size() > 0) {
+                m.gspec.nmr.mask = parse_pattern(m, m.gspec.str.mask);
+            }
+            if (m.gspec.str.start.size() > 0) {
+                m.gspec.nmr.start = parse_pattern(m, m.gspec.str.start);
+            }
+            m.gspec.nmr.values.reserve(m.gspec.nmr.values.size()
+                + m.gspec.str.values.size());
+            for (auto &v : m.gspec.str.values) {
+                if (v.size() > 0) {
+                    m.gspec.nmr.values.push_back(parse_pattern(m, v));
                 }
+            }
+            break;
+            }
+        case Pattern_PRE: {
+            // Only Fixed size is allowed
+            m.gspec.nmr.seed = m.gspec.str.seed;
+            m.gspec.nmr.error = m.gspec.str.error;
+            if (m.gspec.str.value.size() > 0) {
+                m.gspec.nmr.value = parse_pattern(m, m.gspec.str.value);
+            }
+            break;
+            }
+        default: {}
+    }
+}
 
-                for (uint32_t idx=0; idx<m.gspec.str.values.size(); idx++) {
-                    if (m.gspec.str.values[idx].size() > 0) {
-                        tmp_ipv4_string = m.gspec.str.values[idx];
-                        tmp_ipv4 = convert_string_ipv4_internal(tmp_ipv4_string);
-                        m.gspec.nmr.values.push_back(tmp_ipv4);
-                    }
-                }
-                break;
-                }
-            case Pattern_PRE: {
-                // Only Fixed size is allowed
-                m.gspec.nmr.seed = m.gspec.str.seed;
-                m.gspec.nmr.error = m.gspec.str.error;
-                if (m.gspec.str.value.size() > 0) {
-                    m.gspec.nmr.value = stoul(m.gspec.str.value, 0, 16);
-                }
-                break;
-                }
-            default: {}
-        }
+uint64_t cea_stream::core::parse_pattern(cea_field_mutation_spec &m,
+    const string &value) {
+    bool valid = false;
+    uint64_t result = 0;
+    switch (m.defaults.type) {
+        case Pattern_MAC: {
+            valid = cea_parse_mac(value, result);
+            break;
+            }
+        case Pattern_IPv4: {
+            uint32_t addr;
+            valid = cea_parse_ipv4(value, addr);
+            result = addr;
+            break;
+            }
+        case Pattern_PRE: {
+            valid = cea_parse_hex(value, result);
+            break;
+            }
+        default: {}
+    }
+    if (!valid) {
+        CEA_ERR_MSG("The value " << value <<
+        " does not match the acceptable pattern for "
+        << cea_trim(m.defaults.name));
+        abort();
     }
+    return result;
 }
 
 //TODO preamble and ipv6 support is pending
 void cea_stream::core::build_runtime() {
     for (auto &m : mutable_fields) {
-        switch (m.gspec.gen_type) {
-            case Fixed_Value: {
-                m.rt.value = m.gspec.nmr.value;
-                break;
-                }
-            case Increment: {
-                m.rt.value = m.gspec.nmr.start;
-                break;
-                }
-            case Decrement: {
-                m.rt.value = m.gspec.nmr.start;
-                break;
-                }
-            case Value_List: {
-                m.rt.patterns = m.gspec.nmr.values;
-                break;
-                }
-            case Random: {
-                // check and set seed
-                if (m.gspec.nmr.seed != 0) {
-                    m.rnd.engine.seed(m.gspec.nmr.seed);
-                } else {
-                    m.rnd.engine.seed(rd());
-                }
+        build_runtime(m);
+    }
+}
 
-                uint64_t size = m.defaults.len/8;
-
-                if (is_number_in_range(size, 1, 8)) {
-                    uniform_int_distribution<uint64_t>::param_type 
-                        u8param(0, numeric_limits<unsigned char>::max());
-                    m.rnd.ud.param(u8param);
-                } else if (is_number_in_range(size, 9, 16)) {
-                    uniform_int_distribution<uint64_t>::param_type 
-                        u16param(0, numeric_limits<unsigned short>::max());
-                    m.rnd.ud.param(u16param);
-                } else if (is_number_in_range(size, 17, 32)) {
-                    uniform_int_distribution<uint64_t>::param_type 
-                        u32param(0, numeric_limits<uint32_t>::max());
-                    m.rnd.ud.param(u32param);
-                } else if (is_number_in_range(size, 33, 64)) {
-                    uniform_int_distribution<uint64_t>::param_type 
-                        u64param(0, numeric_limits<uint64_t>::max());
-                    m.rnd.ud.param(u64param);
-                }
-                m.rt.value = m.rnd.ud(m.rnd.engine);
-                break;
-                }
-            case Random_In_Range: {
-                // check and set seed
-                if (m.gspec.nmr.seed != 0) {
-                    m.rnd.engine.seed(m.gspec.nmr.seed);
-                } else {
-                    m.rnd.engine.seed(rd());
-                }
+void cea_stream::core::build_runtime(cea_field_mutation_spec &m) {
+    switch (m.gspec.gen_type) {
+        case Fixed_Value: {
+            m.rt.value = m.gspec.nmr.value;
+            break;
+            }
+        case Increment: {
+            m.rt.value = m.gspec.nmr.start;
+            break;
+            }
+        case Decrement: {
+            m.rt.value = m.gspec.nmr.start;
+            break;
+            }
+        case Value_List: {
+            // a loaded plan has already pointed the patterns into its mapping
+            if (!m.gspec.nmr.values.empty()) {
+                auto values = make_shared<const vector<uint64_t>>(
+                    m.gspec.nmr.values);
+                m.rt.patterns = shared_ptr<const uint64_t>(values,
+                    values->data());
+                m.rt.nof_patterns = values->size();
+            }
+            break;
+            }
+        case Random: {
+            // check and set seed
+            if (m.gspec.nmr.seed != 0) {
+                m.rnd.engine.seed(m.gspec.nmr.seed);
+            } else {
+                m.rnd.engine.seed(rd());
+            }
+
+            uint64_t size = m.defaults.len/8;
+
+            if (is_number_in_range(size, 1, 8)) {
                 uniform_int_distribution<uint64_t>::param_type 
-                    param(m.gspec.nmr.min, m.gspec.nmr.max);
-                m.rnd.ud.param(param);
-                m.rt.value = m.rnd.ud(m.rnd.engine);
-                break;
-                }
-            case Weighted_Distribution: { // TODO only for frame size mutation
-                if (m.gspec.nmr.seed != 0) {
-                    m.rnd.engine.seed(m.gspec.nmr.seed);
-                } else {
-                    m.rnd.engine.seed(rd());
-                }
-                for (auto item : m.gspec.nmr.distr) {
-                    m.rnd.wd_lenghts.push_back(item.first);
-                }
-                for (auto item : m.gspec.nmr.distr) {
-                    m.rnd.wd_weights.push_back(item.second);
-                }
-                discrete_distribution<uint64_t>::param_type
-                    param(m.rnd.wd_weights.begin(), m.rnd.wd_weights.end());
-                m.rnd.wd.param(param);
-                // generate lenght values in build_payload_arrays
-                break;
-                }
-            default: {
-                // TODO add message
-                }
-        } // switch
-    } // for
+                    u8param(0, numeric_limits<unsigned char>::max());
+                m.rnd.ud.param(u8param);
+            } else if (is_number_in_range(size, 9, 16)) {
+                uniform_int_distribution<uint64_t>::param_type 
+                    u16param(0, numeric_limits<unsigned short>::max());
+                m.rnd.ud.param(u16param);
+            } else if (is_number_in_range(size, 17, 32)) {
+                uniform_int_distribution<uint64_t>::param_type 
+                    u32param(0, numeric_limits<uint32_t>::max());
+                m.rnd.ud.param(u32param);
+            } else if (is_number_in_range(size, 33, 64)) {
+                uniform_int_distribution<uint64_t>::param_type 
+                    u64param(0, numeric_limits<uint64_t>::max());
+                m.rnd.ud.param(u64param);
+            }
+            m.rt.value = m.rnd.ud(m.rnd.engine);
+            break;
+            }
+        case Random_In_Range: {
+            // check and set seed
+            if (m.gspec.nmr.seed != 0) {
+                m.rnd.engine.seed(m.gspec.nmr.seed);
+            } else {
+                m.rnd.engine.seed(rd());
+            }
+            uniform_int_distribution<uint64_t>::param_type 
+                param(m.gspec.nmr.min, m.gspec.nmr.max);
+            m.rnd.ud.param(param);
+            m.rt.value = m.rnd.ud(m.rnd.engine);
+            break;
+            }
+        case Weighted_Distribution: { // TODO only for frame size mutation
+            if (m.gspec.nmr.seed != 0) {
+                m.rnd.engine.seed(m.gspec.nmr.seed);
+            } else {
+                m.rnd.engine.seed(rd());
+            }
+            for (auto item : m.gspec.nmr.distr) {
+                m.rnd.wd_lenghts.push_back(item.first);
+            }
+            for (auto item : m.gspec.nmr.distr) {
+                m.rnd.wd_weights.push_back(item.second);
+            }
+            discrete_distribution<uint64_t>::param_type
+                param(m.rnd.wd_weights.begin(), m.rnd.wd_weights.end());
+            m.rnd.wd.param(param);
+            // generate lenght values in build_payload_arrays
+            break;
+            }
+        default: {
+            // TODO add message
+            }
+    } // switch
 }
 
 // TODO Incomplete implementation
 void cea_stream::core::build_principal_frame() {
 
     // print_fields(frame_fields);
-    uint32_t ofs = splice_frame_fields(pf);
+    fill_principal_frame(frame_fields);
 
     auto len_item = get_field(stream_properties, FRAME_Len);
     cea_field_genspec lenspec = len_item.gspec;
 
+    print_uchar_array(pf, hdr_len/8+lenspec.nmr.value, "Principal Frame");
+    // txpcap->write(pf, ploffset+lenspec.nmr.value); 
+}
+
+void cea_stream::core::fill_principal_frame(
+    const vector<cea_field_mutation_spec> &fields) {
+    splice_frame_fields(pf, fields);
+
     auto pl_item = get_field(stream_properties, PAYLOAD_Pattern);
     cea_field_genspec plspec = pl_item.gspec;
 
     uint32_t ploffset = hdr_len/8;
 
+    // fill the payload for the largest frame of the size schedule
+    uint32_t pllen = min(max_frame_size, (uint32_t)CEA_MAX_FRAME_SIZE);
+
     if (plspec.gen_type == Random)
-        memcpy(pf+ploffset, arof_rnd_payload_data[0], lenspec.nmr.value);
+        memcpy(pf+ploffset, arof_rnd_payload_data[0].get(), pllen);
     else 
-        memcpy(pf+ploffset, arof_payload_data, lenspec.nmr.value);
+        memcpy(pf+ploffset, arof_payload_data.get(), pllen);
+}
+
+
+void cea_stream::core::build_meta_templates() {
+    uint8_t channel = stream_id & 0xff;
+
+    // one template per distinct combination, keyed by frame size since the
+    // channel is fixed for the stream and the ipg depends only on the size
+    map<uint32_t, uint32_t> template_of_size;
+    for (auto size : vof_frame_sizes) {
+        template_of_size.insert({size, template_of_size.size()});
+    }
+
+    nof_meta_templates = template_of_size.size();
+    free(arof_meta_templates);
+    arof_meta_templates = (tx_metadata*) aligned_alloc(CEA_CACHELINE,
+        nof_meta_templates * sizeof(tx_metadata));
+
+    for (auto item : template_of_size) {
+        tx_metadata *meta = arof_meta_templates + item.second;
+        memset(meta, 0, sizeof(tx_metadata));
+        meta->tx_disable_crc = 0;
+        meta->len = item.first;
+        meta->is_dummy = 0;
+        meta->has_fcs = (replay == nullptr);
+        meta->start_stream_ch = channel;
+        meta->ipg = 0; // filled by build_rate_schedule
+    }
 
-    print_uchar_array(pf, ploffset+lenspec.nmr.value, "Principal Frame");
-    // txpcap->write(pf, ploffset+lenspec.nmr.value); 
+    vof_meta_template_idx.resize(nof_sizes);
+    for (uint32_t idx=0; idx<nof_sizes; idx++) {
+        vof_meta_template_idx[idx] = template_of_size[vof_frame_sizes[idx]];
+    }
 }
 
-
 // TODO enclose mutate with perf timers
 // TODO what if there are no mutables
 void cea_stream::core::mutate() {
@@ -2062,8 +5869,8 @@ void cea_stream::core::mutate() {
                             break;
                             }
                         case Value_List: { // TESTED
-                            cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns[m->rt.idx], m->defaults.len/8);
-                            if (m->rt.idx < m->rt.patterns.size()-1) {
+                            cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns.get()[m->rt.idx], m->defaults.len/8);
+                            if (m->rt.idx < m->rt.nof_patterns-1) {
                                 m->rt.idx++;
                             } else {
                                 if (m->gspec.nmr.repeat) {
@@ -2128,8 +5935,8 @@ void cea_stream::core::mutate() {
                             break;
                             }
                         case Value_List: {
-                            cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns[m->rt.idx], m->defaults.len/8);
-                            if (m->rt.idx < m->rt.patterns.size()-1) {
+                            cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns.get()[m->rt.idx], m->defaults.len/8);
+                            if (m->rt.idx < m->rt.nof_patterns-1) {
                                 m->rt.idx++;
                             } else {
                                 if (m->gspec.nmr.repeat) {
@@ -2212,9 +6019,9 @@ void cea_stream::core::init_stream_properties() {
     stream_properties.clear();
     vector<cea_field_id> prop_ids =  header_to_field_map[PROPERTIES];
 
+    stream_properties.reserve(prop_ids.size());
     for (auto id : prop_ids) {
-        auto item = get_field(mtable, id);
-        stream_properties.push_back(item);
+        stream_properties.push_back(get_field(mtable, id));
     }
 }
  
@@ -2229,8 +6036,32 @@ void cea_stream::core::reset() {
     udfs.clear();
     init_stream_properties();
 
-    // TODO memory leak when reset is done twice in same test
-    pf = new unsigned char [CEA_PF_SIZE];
+    // allocated on bootstrap, a clone that shares a plan needs only the
+    // length of its largest frame
+    pf = nullptr;
+    pf_size = 0;
+    field_overrides.clear();
+    source = nullptr;
+    boot_headers.clear();
+    boot_overrides.clear();
+    boot_shape = 0;
+    plan_source = nullptr;
+
+    arof_meta_templates = nullptr;
+    nof_meta_templates = 0;
+
+    txpcap = nullptr;
+    rx_record = false;
+    tbpcap = nullptr;
+    replay = nullptr;
+    sig_enable = false;
+    sig_seq = 0;
+    sig_dirty = false;
+    rate_from_bandwidth = false;
+    bw_unit = Percent;
+    ipg_unit = Bytes;
+    isg_unit = Bytes;
+    ibg_unit = Bytes;
 
     payload_pattern_size = 0;
 
@@ -2244,52 +6075,34 @@ void cea_stream::core::reset() {
 }
 
 void cea_stream::core::convert_string_to_uca(string address, unsigned char *op) {
-    vector <string> tokens;
-
-    for (uint32_t i=0; i<address.size(); i+=2) {
-        tokens.push_back(address.substr(i, 2));
-    }
-    for (uint32_t i=0; i<address.size()/2; i++) {
-        op[i]= convert_char_to_int(tokens[i]);
+    if (!cea_parse_hex(address, op)) {
+        CEA_ERR_MSG("The value " << address << " is not a hex string");
+        abort();
     }
 }
 
 void cea_stream::core::convert_mac_to_uca(string address, unsigned char *op) {
-    stringstream check1(address);
-    vector <string> tokens;
-    string intermediate;
-
-    while(getline(check1, intermediate, ':')) {
-        tokens.push_back(intermediate);
-    }
-    for (uint32_t i=0; i<6; i++) {
-        op[i]= convert_char_to_int(tokens[i]);
+    uint64_t mac;
+    if (!cea_parse_mac(address, mac)) {
+        CEA_ERR_MSG("The value " << address << " is not a MAC address");
+        abort();
     }
+    cea_memcpy_ntw_byte_order(op, (char*)&mac, 6);
 }
 
 void cea_stream::core::convert_ipv4_to_uca(string address, unsigned char *op) {
-    stringstream check1(address);
-    string intermediate;
-    int i = 0;
-
-    while(getline(check1, intermediate, '.')) {
-        op[i] = stoi(intermediate);
-        i++;
+    uint32_t addr;
+    if (!cea_parse_ipv4(address, addr)) {
+        CEA_ERR_MSG("The value " << address << " is not an IPv4 address");
+        abort();
     }
+    cea_memcpy_ntw_byte_order(op, (char*)&addr, 4);
 }
 
 void cea_stream::core::convert_ipv6_to_uca(string address, unsigned char *op) {
-    string ipv6addr_tmp = address;
-    vector <string> tokens;
-
-    ipv6addr_tmp.erase(remove(ipv6addr_tmp.begin(), ipv6addr_tmp.end(), ':'),
-        ipv6addr_tmp.end());
-
-    for (size_t i=0; i<ipv6addr_tmp.size(); i+=2) {
-        tokens.push_back(ipv6addr_tmp.substr(i, 2));
-    }
-    for (uint32_t i=0; i<16; i++) { // TODO remove hardcoded value
-        op[i]= convert_char_to_int(tokens[i]);
+    if (!cea_parse_ipv6(address, op)) {
+        CEA_ERR_MSG("The value " << address << " is not an IPv6 address");
+        abort();
     }
 }
 
@@ -2305,50 +6118,12 @@ string cea_stream::core::convert_int_to_ipv4(uint64_t ipAddress) {
 }
 
 uint64_t cea_stream::core::convert_string_ipv4_internal(string addr) {
-    stringstream s;
-    string intermediate;
-    stringstream check1(addr);
-    int i = 0;
-    while(getline(check1, intermediate, '.')) {
-        s << setfill('0') << setw(2) << hex << stoi(intermediate);
-        i++;
-    }
-    return stoul(s.str(), 0, 16);
-}
-
-int cea_stream::core::convert_nibble_to_int (char digit) {
-    int asciiOffset, digitValue;
-    if (digit >= 48 && digit <= 57) {
-        // code for '0' through '9'
-        asciiOffset = 48;
-        digitValue = digit - asciiOffset;
-        return digitValue;
-    } else if (digit >= 65 && digit <= 70) {
-        // digit is 'A' through 'F'
-        asciiOffset = 55;
-        digitValue = digit - asciiOffset;
-        return digitValue;
-    } else if (digit >= 97 && digit <= 122) {
-        // code for 'a' through 'f'
-        asciiOffset = 87;
-        digitValue = digit - asciiOffset;
-        return digitValue;
-    } else {
-        // TODO illegal digit
+    uint32_t value;
+    if (!cea_parse_ipv4(addr, value)) {
+        CEA_ERR_MSG("The value " << addr << " is not an IPv4 address");
+        abort();
     }
-    return 0;
-}
-
-unsigned char cea_stream::core::convert_char_to_int(string hexNumber) {
-     unsigned char aChar;
-     char highOrderDig = hexNumber[0];
-     char lowOrderDig  = hexNumber[1];
-     int lowOrderValue = convert_nibble_to_int(lowOrderDig);
-     //  convert lowOrderDig to number from 0 to 15
-     int highOrderValue = convert_nibble_to_int(highOrderDig);
-     // convert highOrderDig to number from 0 to 15
-     aChar = lowOrderValue + 16 * highOrderValue;
-     return aChar;
+    return value;
 }
 
 // PORTI
@@ -2358,79 +6133,922 @@ unsigned char cea_stream::core::convert_char_to_int(string hexNumber) {
 
 cea_port::cea_port(string name) {
     impl = make_unique<core>(name);
+    controller.ports.publish(impl->port_id, this);
 }
 
-cea_port::~cea_port() = default;
+cea_port::~cea_port() {
+    controller.ports.publish(impl->port_id, nullptr);
+}
 
 cea_port::core::core(string name) {
-    port_id = cea::port_id;
-    cea::port_id++;
+    port_id = controller.ports.allocate();
     port_name = name + ":" + to_string(port_id);
+    txring.width = CEA_IFWIDTH;
+    txring.capacity = CEA_TXRING_SIZE / txring.width;
+    txring.count = 0;
+    txring.base = (unsigned char*) aligned_alloc(CEA_CACHELINE, CEA_TXRING_SIZE);
+    line_rate = CEA_LINE_RATE;
+    interleave = false;
+    backend = Gsfm_Backend;
+    loopback_paced = true;
+    loopback = nullptr;
+    afp = nullptr;
+    shm = nullptr;
+    seq_idx = 0;
+    current_stream = nullptr;
+    txpcapng = nullptr;
+    txpcapng_ifid = 0;
+    rxpcapng = nullptr;
+    rx_reported = 0;
     reset();
     CEA_MSG("Proxy created with name=" << name << " and id=" << port_id);
 }
 
-cea_port::core::~core() = default;
+cea_port::core::~core() {
+    delete afp;
+    delete shm;
+    close_rx();
+    free(txring.base);
+}
+
+void cea_port::core::reset() {
+    msg_prefix = port_name;
+}
+
+void cea_port::core::prepare_streams() {
+    for (auto stream : streamq) {
+        auto s = stream->impl.get();
+        if (txpcapng && !s->tbpcap) {
+            s->tbpcap = new pcap(txpcapng, txpcapng_ifid, s->stream_name,
+                s->stream_id, s->pcap_comment);
+        }
+        uint64_t ticks = timebase.ticks();
+        s->prepare_for_mutation(txring.width, line_rate * 1000000,
+            backend == AF_Packet_Backend);
+        s->boot_ticks[BOOT_Prepare] += timebase.ticks() - ticks;
+    }
+    seq_idx = 0;
+    current_stream = streamq.empty() ? nullptr : streamq[0];
+    if (interleave) {
+        build_scheduler();
+    }
+}
+
+// the streams are bootstrapped and prepared by the testbench before the
+// worker starts, so the worker only transmits
+void cea_port::core::worker() {
+    // messages logged outside of the classes carry the name of the port
+    cea::msg_prefix = msg_prefix;
+
+    if (backend == Loopback_Backend) {
+        run_loopback();
+    } else if (backend == AF_Packet_Backend) {
+        run_af_packet();
+    } else if (backend == Shm_Backend) {
+        run_shm();
+    }
+#if CEA_TRACE_LEVEL > 0
+    cea_trace_writers.fetch_sub(1, memory_order_release);
+#endif
+}
+
+void cea_port::core::run_shm() {
+    shm->connect();
+    if (current_stream != nullptr) {
+        while (!fill(txring.capacity));
+    }
+    shm->finish();
+}
+
+void cea_port::core::run_af_packet() {
+    if (current_stream == nullptr) return;
+    while (!fill(txring.capacity));
+    afp->flush();
+}
+
+// generate all traffic of the port into the loopback, the worker plays the
+// part of the emulator that would otherwise request the elements
+void cea_port::core::run_loopback() {
+    if (current_stream == nullptr) return;
+    loopback = new cea_loopback(port_name, txring.width, line_rate * 1000000,
+        loopback_paced, &rx, &txstats);
+    while (!fill(txring.capacity));
+    loopback->finish();
+    delete loopback;
+    loopback = nullptr;
+}
+
+int cea_port::core::next_pass(cea_stream::core *s) {
+    switch (s->traffic_control) {
+        case Continuous: {
+            s->start_pass(s->ibg);
+            return 0;
+            }
+        case Goto_Next_Stream: {
+            s->finish();
+            if (interleave || seq_idx + 1 == streamq.size()) return 1;
+            seq_idx++;
+            current_stream = streamq[seq_idx];
+            current_stream->impl->start_pass(s->isg);
+            return 0;
+            }
+        default: { // Stop_After_Stream
+            s->finish();
+            return 1;
+            }
+    }
+}
+
+void cea_port::core::build_scheduler() {
+    drr.clear();
+    drr_active.clear();
+    if (streamq.empty()) return;
+
+    long double total = 0;
+    long double min_share = 1;
+    vector<long double> shares;
+    for (auto s : streamq) {
+        long double share = s->impl->line_share();
+        shares.push_back(share);
+        total += share;
+        min_share = min(min_share, share);
+    }
+    for (uint32_t idx=0; idx<streamq.size(); idx++) {
+        auto s = streamq[idx]->impl.get();
+        s->set_port_share(total);
+        int64_t quantum = llroundl(CEA_DRR_QUANTUM * shares[idx] / min_share);
+        drr.push_back({s, quantum, quantum});
+        drr_active.push_back(idx);
+    }
+    CEA_MSG("Interleaving " << streamq.size() << " streams taking "
+        << setprecision(4) << total * 100 << "% of the line");
+}
+
+int cea_port::core::enqueue_interleaved(uint32_t space, bool one_frame) {
+    uint32_t limit = txring.count + space;
+    while (txring.count < limit && !drr_active.empty()) {
+        drr_entry &e = drr[drr_active.front()];
+        cea_stream::core *s = e.stream;
+
+        // out of credit at a frame boundary, move on to the next stream
+        if (s->txdone && e.deficit <= 0) {
+            e.deficit += e.quantum;
+            drr_active.push_back(drr_active.front());
+            drr_active.pop_front();
+            continue;
+        }
+        bool new_frame = s->txdone;
+        int eos = s->mutate_enqueue(txring, limit - txring.count, true);
+        if (new_frame) {
+            e.deficit -= s->frame_len + CEA_PREAMBLE_LEN + CEA_MIN_IPG;
+        }
+        if (eos && next_pass(s)) {
+            drr_active.pop_front();
+        }
+        if (one_frame) break;
+    }
+    return drr_active.empty();
+}
+
+void cea_port::core::start_worker() {
+#if CEA_TRACE_LEVEL > 0
+    cea_trace_writers.fetch_add(1, memory_order_relaxed);
+#endif
+    worker_tid = thread(&cea_port::core::worker, this);
+    char name[16];
+    sprintf(name, "worker_%d", port_id);
+    pthread_setname_np(worker_tid.native_handle(), name);
+}
+
+
+void cea_port::add_stream(cea_stream *stream) {
+    impl->add_stream(stream);
+}
+
+void cea_port::add_cmd(cea_stream *stream) {
+    impl->add_cmd(stream);
+}
+
+void cea_port::exec_cmd(cea_stream *stream) {
+    impl->exec_cmd(stream);
+}
+
+void cea_port::set(cea_port_property_id id, uint64_t value) {
+    impl->set(id, value);
+}
+
+void cea_port::set(cea_stream_feature_id feature, bool mode) {
+    impl->set(feature, mode);
+}
+
+void cea_port::set(cea_port_property_id id, string value) {
+    impl->set(id, value);
+}
+
+// without this a string literal would be converted to uint64_t
+void cea_port::set(cea_port_property_id id, const char *value) {
+    impl->set(id, string(value));
+}
+
+void cea_port::core::set(cea_port_property_id id, string value) {
+    switch (id) {
+        case PORT_Interface_Name: {
+            ifname = value;
+            break;
+            }
+        case PORT_Socket_Path: {
+            socket_path = value;
+            break;
+            }
+        default:{
+            CEA_ERR_MSG("The ID " << id << " does not accept a string value");
+            abort();
+            }
+    }
+}
+
+void cea_port::core::set(cea_port_property_id id, uint64_t value) {
+    switch (id) {
+        case PORT_Interface_Width: {
+            if (!cea_is_valid_ifwidth(value)) {
+                CEA_ERR_MSG("Interface width " << value << " is not supported."
+                    << " Valid widths are 16, 32, 64, 128, 256 and 512 bytes");
+                abort();
+            }
+            txring.width = value;
+            txring.capacity = CEA_TXRING_SIZE / txring.width;
+            rx.set_width(value);
+            break;
+            }
+        case PORT_Line_Rate: {
+            if (value == 0) {
+                CEA_ERR_MSG("Line rate cannot be zero");
+                abort();
+            }
+            line_rate = value;
+            break;
+            }
+        case PORT_Interleave: {
+            interleave = (value != 0);
+            break;
+            }
+        case PORT_Backend: {
+            if (value != Gsfm_Backend && value != Loopback_Backend
+                && value != AF_Packet_Backend && value != Shm_Backend) {
+                CEA_ERR_MSG("Backend " << value << " is not supported");
+                abort();
+            }
+            backend = value;
+            break;
+            }
+        case PORT_Loopback_Paced: {
+            loopback_paced = (value != 0);
+            break;
+            }
+        default:{
+            CEA_ERR_MSG("The ID " << id << " does not belong to port properties");
+            abort();
+            }
+    }
+}
+
+void cea_port::core::set(cea_stream_feature_id feature, bool mode) {
+    switch (feature) {
+        case PCAP_Record_Rx_Enable: {
+            if (mode && rxpcapng == nullptr) {
+                CEA_MSG("PCAPNG capture enabled @ Receive side");
+                rxpcapng = new pcapng("port" + to_string(port_id) + "_rx.pcapng");
+                uint32_t ifid = rxpcapng->add_interface(port_name);
+                rx.rxpcap = new pcap(rxpcapng, ifid, port_name, port_id, "");
+            }
+            break;
+            }
+        case Rx_Analyzer_Enable: {
+            if (mode && rx.analyzer == nullptr) {
+                CEA_MSG("Signature analysis enabled @ Receive side");
+                rx.analyzer = new cea_rx_analyzer;
+                rx.analyzer->msg_prefix = port_name;
+            }
+            break;
+            }
+        default:{
+            CEA_ERR_MSG("The feature " << cea_stream_feature_name[feature]
+                << " is not supported on the port");
+            abort();
+            }
+    }
+}
+
+void cea_port::core::receive(unsigned char *elems, uint32_t n) {
+    rx.receive(elems, n);
+}
+
+void cea_port::core::close_rx() {
+    // the analyzer stays for the snapshots taken after the run
+    if (rx.analyzer && rx.stats.frames != rx_reported) {
+        rx_reported = rx.stats.frames;
+        rx.analyzer->report();
+    }
+    if (rx.rxpcap == nullptr) return;
+    delete rx.rxpcap;
+    rx.rxpcap = nullptr;
+    delete rxpcapng;
+    rxpcapng = nullptr;
+    CEA_MSG("Received " << rx.stats.frames << " frames, " << rx.stats.bytes
+        << " bytes, " << rx.stats.errors << " framing errors");
+}
+
+void cea_port::core::add_stream(cea_stream *stream) {
+    auto sc = stream->impl.get();
+    if (!sc->port_name.empty() && sc->port_name != port_name) {
+        CEA_ERR_MSG("Stream " << sc->msg_prefix << " is added to port "
+            << sc->port_name << " already, add a clone of it to this port");
+        abort();
+    }
+    sc->port_name = port_name;
+    if (sc->rx_record) {
+        set(PCAP_Record_Rx_Enable, true);
+    }
+    streamq.push_back(stream);
+}
+
+void cea_port::core::read_stats(cea_port_stats &ps) {
+    ps = {};
+    ps.id = port_id;
+    ps.name = port_name;
+    txstats.read(ps.tx);
+    ps.tx.frames = 0;
+    ps.tx.bytes = 0;
+    for (auto s : streamq) {
+        cea_counters c = {};
+        s->impl->stats.read(c);
+        ps.tx.frames += c.frames;
+        ps.tx.bytes += c.bytes;
+        ps.tx.pcap_drops += c.pcap_drops;
+    }
+    rx.stats.read(ps.rx);
+    // waits of the loopback drain for the emulated line
+    ps.tx.rate_waits += ps.rx.rate_waits;
+    ps.rx.rate_waits = 0;
+}
+
+void cea_port::core::add_cmd(cea_stream *stream) {
+    add_stream(stream);
+}
+
+void cea_port::core::exec_cmd(cea_stream *stream) {
+// TODO pending implementation
+}
+
+// open the interface of the port, called for all ports before any worker
+// starts so that no port transmits before the receive side of its peer is up
+void cea_port::core::open_backend() {
+    if (backend == AF_Packet_Backend && afp == nullptr) {
+        if (ifname.empty()) {
+            CEA_ERR_MSG("AF_PACKET backend needs PORT_Interface_Name");
+            abort();
+        }
+        afp = new cea_af_packet(ifname, txring.width, line_rate * 1000000, &rx,
+            &txstats);
+    }
+    if (backend == Shm_Backend && shm == nullptr) {
+        if (socket_path.empty()) {
+            CEA_ERR_MSG("Shm backend needs PORT_Socket_Path");
+            abort();
+        }
+        shm = new cea_shm(socket_path, txring.width, &txstats);
+    }
+}
+
+void cea_port::core::start() {
+    start_worker();
+}
+
+void cea_port::core::stop() {
+// TODO pending implementation
+    if (afp) {
+        delete afp;
+        afp = nullptr;
+    }
+    if (shm) {
+        delete shm;
+        shm = nullptr;
+    }
+    close_rx();
+}
+
+void cea_port::core::pause() {
+// TODO pending implementation
+}
+ 
+//------------------------------------------------------------------------------
+// support for stream spec files
+//------------------------------------------------------------------------------
+
+// reader of the JSON text of a spec file. The values are consumed in the
+// order of the file, there is no document tree. A malformed file aborts with
+// the line of the error
+class cea_spec_reader {
+public:
+    cea_spec_reader(string fname);
+    ~cea_spec_reader();
+
+    // first character of the next value, one of {["tfn or a digit
+    char peek();
+
+    // call f with the key of each member of an object, f must consume the
+    // value of the member
+    template <typename F> void object(F f);
+
+    // call f for each element of an array, f must consume the element
+    template <typename F> void array(F f);
+
+    string str();
+    uint64_t u64();
+    double dbl();
+    bool boolean();
+
+    // consume a value of any type
+    void skip();
+
+    [[noreturn]] void error(string msg);
+
+private:
+    void skip_ws();
+    void expect(char c);
+
+    string fname;
+    string msg_prefix;
+    char *data;
+    size_t size;
+    const char *p;
+    const char *end;
+};
+
+cea_spec_reader::cea_spec_reader(string fname) {
+    this->fname = fname;
+    msg_prefix = fname;
+    data = nullptr;
+    size = 0;
+
+    int fd = open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        CEA_ERR_MSG("Cannot open the spec file " << fname << ": "
+            << strerror(errno));
+        abort();
+    }
+    size = st.st_size;
+    if (size > 0) {
+        data = (char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+            fd, 0);
+        if (data == MAP_FAILED) {
+            CEA_ERR_MSG("Cannot map the spec file " << fname << ": "
+                << strerror(errno));
+            abort();
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    p = data;
+    end = data + size;
+}
+
+cea_spec_reader::~cea_spec_reader() {
+    if (data != nullptr) {
+        munmap(data, size);
+    }
+}
+
+void cea_spec_reader::error(string msg) {
+    uint32_t line = 1 + count(static_cast<const char*>(data), p, '\n');
+    CEA_ERR_MSG("line " << line << ": " << msg);
+    abort();
+}
+
+void cea_spec_reader::skip_ws() {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+}
+
+void cea_spec_reader::expect(char c) {
+    skip_ws();
+    if (p == end || *p != c) {
+        error(string("expected '") + c + "'");
+    }
+    p++;
+}
+
+char cea_spec_reader::peek() {
+    skip_ws();
+    if (p == end) {
+        error("unexpected end of file");
+    }
+    return *p;
+}
+
+template <typename F>
+void cea_spec_reader::object(F f) {
+    expect('{');
+    if (peek() == '}') {
+        p++;
+        return;
+    }
+    while (true) {
+        string key = str();
+        expect(':');
+        f(key);
+        if (peek() == ',') {
+            p++;
+            continue;
+        }
+        expect('}');
+        return;
+    }
+}
+
+template <typename F>
+void cea_spec_reader::array(F f) {
+    expect('[');
+    if (peek() == ']') {
+        p++;
+        return;
+    }
+    while (true) {
+        f();
+        if (peek() == ',') {
+            p++;
+            continue;
+        }
+        expect(']');
+        return;
+    }
+}
+
+string cea_spec_reader::str() {
+    expect('"');
+    string s;
+    const char *start = p;
+    while (true) {
+        const char *q = start;
+        while (q < end && *q != '"' && *q != '\\') q++;
+        if (q == end) {
+            error("unterminated string");
+        }
+        s.append(start, q);
+        p = q + 1;
+        if (*q == '"') {
+            return s;
+        }
+        // escape
+        if (p == end) {
+            error("unterminated string");
+        }
+        switch (*p) {
+            case '"' : s += '"'; break;
+            case '\\': s += '\\'; break;
+            case '/' : s += '/'; break;
+            case 'b' : s += '\b'; break;
+            case 'f' : s += '\f'; break;
+            case 'n' : s += '\n'; break;
+            case 'r' : s += '\r'; break;
+            case 't' : s += '\t'; break;
+            case 'u' : {
+                uint64_t c;
+                if (end - p < 5 || !cea_parse_hex(string(p + 1, 4), c)
+                    || c > 0x7f) {
+                    error("only ascii \\u escapes are supported");
+                }
+                s += (char) c;
+                p += 4;
+                break;
+                }
+            default: error("invalid escape in string");
+        }
+        p++;
+        start = p;
+    }
+}
+
+uint64_t cea_spec_reader::u64() {
+    skip_ws();
+    const char *start = p;
+    uint64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        uint64_t next = value * 10 + (*p - '0');
+        if (next / 10 != value) {
+            error("integer out of range");
+        }
+        value = next;
+        p++;
+    }
+    if (p == start || (p < end && (*p == '.' || *p == 'e' || *p == 'E'))) {
+        error("expected an unsigned integer");
+    }
+    return value;
+}
+
+double cea_spec_reader::dbl() {
+    skip_ws();
+    // the number ends at the first delimiter, so strtod cannot run past the
+    // end of the mapping
+    const char *q = p;
+    while (q < end && (isdigit(*q) || *q == '-' || *q == '+' || *q == '.'
+        || *q == 'e' || *q == 'E')) {
+        q++;
+    }
+    string num(p, q);
+    char *last;
+    double value = strtod(num.c_str(), &last);
+    if (num.empty() || *last != 0) {
+        error("expected a number");
+    }
+    p = q;
+    return value;
+}
+
+bool cea_spec_reader::boolean() {
+    skip_ws();
+    if (end - p >= 4 && memcmp(p, "true", 4) == 0) {
+        p += 4;
+        return true;
+    }
+    if (end - p >= 5 && memcmp(p, "false", 5) == 0) {
+        p += 5;
+        return false;
+    }
+    error("expected true or false");
+}
 
-void cea_port::core::reset() {
-    msg_prefix = port_name;
+void cea_spec_reader::skip() {
+    switch (peek()) {
+        case '{': object([&](string &key) { skip(); }); break;
+        case '[': array([&]() { skip(); }); break;
+        case '"': str(); break;
+        case 't':
+        case 'f': boolean(); break;
+        case 'n': {
+            if (end - p < 4 || memcmp(p, "null", 4) != 0) {
+                error("invalid value");
+            }
+            p += 4;
+            break;
+            }
+        default: dbl();
+    }
 }
 
-void cea_port::core::worker() {
-    vector<cea_stream*>::iterator it;
+// builds the ports and streams of a spec file while it is read and adds them
+// to the testbench
+class cea_spec_loader {
+public:
+    cea_spec_loader(cea_testbench *tb, string fname);
+    void load();
 
-    for (it = streamq.begin(); it != streamq.end(); it++) {
-        current_stream = *it;
-        current_stream->impl->bootstrap_stream();
-        current_stream->impl->prepare_for_mutation();
-        // current_stream->impl->mutate();
+private:
+    void load_port(string name);
+    cea_stream *load_stream(string name);
+    cea_header *load_header(string type);
+    void load_field(cea_header *hdr, cea_field_id id);
+    void load_property(cea_stream *stream, cea_field_id id);
+    cea_field_genspec load_genspec(cea_unit *unit = nullptr);
+
+    // index of name in a table of names, aborts if it is not there
+    uint32_t lookup(const vector<string> &names, const string &name,
+        const char *what);
+
+    // integer written as a string such as "0x0800"
+    bool parse_literal(const string &s, uint64_t &value);
+
+    cea_testbench *tb;
+    cea_spec_reader in;
+    map<string, cea_field_id> field_ids;
+};
+
+cea_spec_loader::cea_spec_loader(cea_testbench *tb, string fname)
+    : in(fname) {
+    this->tb = tb;
+    for (auto &f : mtable) {
+        field_ids[cea_trim(f.defaults.name)] = f.defaults.id;
     }
 }
 
-void cea_port::core::start_worker() {
-    worker_tid = thread(&cea_port::core::worker, this);
-    char name[16];
-    sprintf(name, "worker_%d", port_id);
-    pthread_setname_np(worker_tid.native_handle(), name);
+uint32_t cea_spec_loader::lookup(const vector<string> &names,
+    const string &name, const char *what) {
+    auto it = find(names.begin(), names.end(), name);
+    if (it == names.end()) {
+        in.error(name + " is not a " + what);
+    }
+    return distance(names.begin(), it);
 }
 
-
-void cea_port::add_stream(cea_stream *stream) {
-    impl->add_stream(stream);
+bool cea_spec_loader::parse_literal(const string &s, uint64_t &value) {
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        return cea_parse_hex(s.substr(2), value);
+    }
+    return false;
 }
 
-void cea_port::add_cmd(cea_stream *stream) {
-    impl->add_cmd(stream);
+void cea_spec_loader::load() {
+    in.object([&](string &key) {
+        if (key == "ports") {
+            in.object([&](string &name) { load_port(name); });
+        } else {
+            uint32_t feature = lookup(cea_stream_feature_name, key, "feature");
+            tb->set((cea_stream_feature_id) feature, in.boolean());
+        }
+    });
 }
 
-void cea_port::exec_cmd(cea_stream *stream) {
-    impl->exec_cmd(stream);
+void cea_spec_loader::load_port(string name) {
+    cea_port *port = new cea_port(name);
+    tb->add_port(port);
+    in.object([&](string &key) {
+        if (key == "streams") {
+            in.object([&](string &stream_name) {
+                port->add_stream(load_stream(stream_name));
+            });
+            return;
+        }
+        auto prop = find(cea_port_property_name.begin(),
+            cea_port_property_name.end(), key);
+        if (prop != cea_port_property_name.end()) {
+            auto id = (cea_port_property_id)
+                distance(cea_port_property_name.begin(), prop);
+            if (in.peek() != '"') {
+                port->set(id, in.u64());
+            } else if (id == PORT_Backend) {
+                port->set(id, lookup(cea_port_backend_name, in.str(),
+                    "backend"));
+            } else {
+                port->set(id, in.str());
+            }
+            return;
+        }
+        uint32_t feature = lookup(cea_stream_feature_name, key,
+            "port property or feature");
+        port->set((cea_stream_feature_id) feature, in.boolean());
+    });
 }
 
-void cea_port::core::add_stream(cea_stream *stream) {
-    streamq.push_back(stream);
+cea_stream *cea_spec_loader::load_stream(string name) {
+    cea_stream *stream = new cea_stream(name);
+    in.object([&](string &key) {
+        if (key == "headers") {
+            in.array([&]() {
+                in.object([&](string &type) {
+                    stream->add_header(load_header(type));
+                });
+            });
+            return;
+        }
+        auto field = field_ids.find(key);
+        if (field != field_ids.end()) {
+            load_property(stream, field->second);
+            return;
+        }
+        auto id = (cea_stream_feature_id) lookup(cea_stream_feature_name, key,
+            "stream property or feature");
+        if (in.peek() == '"') {
+            stream->set(id, in.str());
+        } else {
+            stream->set(id, in.boolean());
+        }
+    });
+    return stream;
 }
 
-void cea_port::core::add_cmd(cea_stream *stream) {
-    add_stream(stream);
+void cea_spec_loader::load_property(cea_stream *stream, cea_field_id id) {
+    switch (in.peek()) {
+        case '"': {
+            // name of a generation type such as Continuous or Bursty
+            stream->set(id, lookup(cea_gen_type_name, in.str(),
+                "generation type"));
+            break;
+            }
+        case '{': {
+            cea_unit unit = (cea_unit) -1;
+            cea_field_genspec spec = load_genspec(&unit);
+            if (unit != (cea_unit) -1) {
+                stream->set(id, spec.nmr.value, unit);
+            } else {
+                stream->set(id, spec);
+            }
+            break;
+            }
+        default: stream->set(id, in.u64());
+    }
 }
 
-void cea_port::core::exec_cmd(cea_stream *stream) {
-// TODO pending implementation
+cea_header *cea_spec_loader::load_header(string type) {
+    auto hdr_type = (cea_header_type) lookup(cea_header_name, type, "header");
+    cea_header *hdr = new cea_header(hdr_type);
+    in.object([&](string &key) {
+        auto field = field_ids.find(key);
+        if (field == field_ids.end()) {
+            in.error(key + " is not a field");
+        }
+        load_field(hdr, field->second);
+    });
+    return hdr;
 }
 
-void cea_port::core::start() {
-    start_worker();
+void cea_spec_loader::load_field(cea_header *hdr, cea_field_id id) {
+    switch (in.peek()) {
+        case '"': {
+            string value = in.str();
+            uint64_t literal;
+            if (parse_literal(value, literal)) {
+                hdr->set(id, literal);
+            } else {
+                hdr->set(id, value);
+            }
+            break;
+            }
+        case '{': hdr->set(id, load_genspec()); break;
+        default: hdr->set(id, in.u64());
+    }
 }
 
-void cea_port::core::stop() {
-// TODO pending implementation
+// the values of an integer field are numbers and go to the nmr part of the
+// spec, the values of a pattern field are strings and go to the str part
+cea_field_genspec cea_spec_loader::load_genspec(cea_unit *unit) {
+    cea_field_genspec spec = {};
+    auto number = [&](uint64_t &nmr, string &str) {
+        if (in.peek() == '"') {
+            str = in.str();
+            if (parse_literal(str, nmr)) str.clear();
+        } else {
+            nmr = in.u64();
+        }
+    };
+    auto integer = [&](uint64_t &nmr, uint64_t &str) {
+        nmr = (in.peek() == 't' || in.peek() == 'f') ? in.boolean() : in.u64();
+        str = nmr;
+    };
+    in.object([&](string &key) {
+        if (key == "gen_type") {
+            spec.gen_type = (cea_gen_type) lookup(cea_gen_type_name, in.str(),
+                "generation type");
+        } else if (key == "value") {
+            number(spec.nmr.value, spec.str.value);
+        } else if (key == "min") {
+            number(spec.nmr.min, spec.str.min);
+        } else if (key == "max") {
+            number(spec.nmr.max, spec.str.max);
+        } else if (key == "mask") {
+            number(spec.nmr.mask, spec.str.mask);
+        } else if (key == "start") {
+            number(spec.nmr.start, spec.str.start);
+        } else if (key == "step") {
+            integer(spec.nmr.step, spec.str.step);
+        } else if (key == "count") {
+            integer(spec.nmr.count, spec.str.count);
+        } else if (key == "repeat") {
+            integer(spec.nmr.repeat, spec.str.repeat);
+        } else if (key == "seed") {
+            integer(spec.nmr.seed, spec.str.seed);
+        } else if (key == "error") {
+            spec.nmr.error = spec.str.error = in.boolean();
+        } else if (key == "values") {
+            in.array([&]() {
+                if (in.peek() != '"') {
+                    spec.nmr.values.push_back(in.u64());
+                    return;
+                }
+                string s = in.str();
+                uint64_t value;
+                if (parse_literal(s, value)) {
+                    spec.nmr.values.push_back(value);
+                } else {
+                    spec.str.values.push_back(move(s));
+                }
+            });
+        } else if (key == "distr") {
+            // pairs of value and weight
+            in.array([&]() {
+                pair<uint64_t, double> item;
+                uint32_t idx = 0;
+                in.array([&]() {
+                    if (idx == 0) item.first = in.u64();
+                    else if (idx == 1) item.second = in.dbl();
+                    else in.error("a distribution item is a value and a weight");
+                    idx++;
+                });
+                spec.nmr.distr.push_back(item);
+            });
+        } else if (key == "distr_name") {
+            spec.nmr.distr_name = in.str();
+        } else if (key == "unit" && unit != nullptr) {
+            *unit = (cea_unit) lookup(cea_unit_name, in.str(), "unit");
+        } else {
+            in.error(key + " is not a member of a generation spec");
+        }
+    });
+    return spec;
 }
 
-void cea_port::core::pause() {
-// TODO pending implementation
-}
- 
 // TBI
 //------------------------------------------------------------------------------
 // Testbench Implementation
@@ -2443,6 +7061,10 @@ cea_testbench::cea_testbench() {
 cea_testbench::~cea_testbench() = default;
 
 cea_testbench::core::core() {
+    msg_prefix = "testbench";
+    txpcapng = nullptr;
+    last.tstamp_ns = timebase.now_ns();
+    last.interval = 0;
 }
 
 cea_testbench::core::~core() = default;
@@ -2465,8 +7087,6 @@ void cea_testbench::exec_cmd(cea_stream *stream, cea_port *port) {
 
 void cea_testbench::core::add_port(cea_port *port) {
     ports.push_back(port);
-    controller.gports[controller.port_cntr] = port;
-    controller.port_cntr++;
 }
 
 void cea_testbench::core::add_stream(cea_stream *stream, cea_port *port) {
@@ -2482,8 +7102,11 @@ void cea_testbench::core::add_stream(cea_stream *stream, cea_port *port) {
             }
         }
     } else {
-        for (uint32_t idx=0; idx<ports.size(); idx++) {
-            ports[idx]->add_stream(stream);
+        // a stream runs on one port, the other ports get a clone of it
+        ports[0]->add_stream(stream);
+        for (uint32_t idx=1; idx<ports.size(); idx++) {
+            ports[idx]->add_stream(stream->clone(stream->impl->stream_name
+                + "@" + ports[idx]->impl->port_name));
         }
     }
 }
@@ -2500,6 +7123,111 @@ void cea_testbench::start(cea_port *port) {
     impl->start(port);
 }
 
+void cea_testbench::set(cea_stream_feature_id feature, bool mode) {
+    impl->set(feature, mode);
+}
+
+cea_stats cea_testbench::snapshot() {
+    return impl->snapshot();
+}
+
+void cea_testbench::load(string fname) {
+    impl->load(this, fname);
+}
+
+void cea_testbench::core::load(cea_testbench *tb, string fname) {
+    cea_timer timer;
+    timer.start();
+    cea_spec_loader loader(tb, fname);
+    loader.load();
+    CEA_MSG("Loaded " << fname << " in " << timer.elapsed_in_string(3));
+}
+
+void cea_testbench::core::set(cea_stream_feature_id feature, bool mode) {
+    switch (feature) {
+        case PCAPNG_Record_Tx_Enable: {
+            if (mode && txpcapng == nullptr) {
+                CEA_MSG("PCAPNG capture enabled @ Transmit side of all ports");
+                txpcapng = new pcapng("run_tx.pcapng");
+            }
+            break;
+            }
+        default:{
+            CEA_ERR_MSG("The feature " << cea_stream_feature_name[feature]
+                << " is not supported on the testbench");
+            abort();
+            }
+    }
+}
+
+// rates of the counters over the interval to their previous value
+static void cea_stat_rates(cea_counters &c, const cea_counters *prev,
+    double interval) {
+    if (interval <= 0) return;
+    uint64_t frames = prev ? c.frames - prev->frames : c.frames;
+    uint64_t bytes = prev ? c.bytes - prev->bytes : c.bytes;
+    c.pps = frames / interval;
+    c.bps = bytes * 8.0 / interval;
+}
+
+cea_stats cea_testbench::core::snapshot() {
+    cea_stats st;
+    st.tstamp_ns = timebase.now_ns();
+    st.interval = (st.tstamp_ns - last.tstamp_ns) / 1e9;
+
+    for (auto p : ports) {
+        cea_port_stats ps;
+        p->impl->read_stats(ps);
+        const cea_port_stats *prev = nullptr;
+        for (auto &lp : last.ports) {
+            if (lp.id == ps.id) prev = &lp;
+        }
+        cea_stat_rates(ps.tx, prev ? &prev->tx : nullptr, st.interval);
+        cea_stat_rates(ps.rx, prev ? &prev->rx : nullptr, st.interval);
+        st.ports.push_back(ps);
+
+        for (auto s : p->impl->streamq) {
+            auto sc = s->impl.get();
+            auto seen = find_if(st.streams.begin(), st.streams.end(),
+                [&sc](const cea_stream_stats &item) {
+                return (item.id == sc->stream_id); });
+            if (seen != st.streams.end()) continue;
+
+            cea_stream_stats ss = {};
+            ss.id = sc->stream_id;
+            ss.name = sc->stream_name;
+            sc->stats.read(ss.tx);
+            for (auto q : ports) {
+                auto an = q->impl->rx.analyzer;
+                const cea_rx_flow *f = an ? an->flow(ss.id) : nullptr;
+                if (f == nullptr) continue;
+                cea_histogram h;
+                f->read(h);
+                ss.latency.merge(h);
+            }
+            const cea_stream_stats *sprev = nullptr;
+            for (auto &ls : last.streams) {
+                if (ls.id == ss.id) sprev = &ls;
+            }
+            cea_stat_rates(ss.tx, sprev ? &sprev->tx : nullptr, st.interval);
+            st.streams.push_back(ss);
+        }
+    }
+    last = st;
+    return st;
+}
+
+// add an interface to the pcapng file for every port that is not in it yet
+void cea_testbench::core::add_pcapng_interfaces() {
+    if (txpcapng == nullptr) return;
+    for (auto p : ports) {
+        if (p->impl->txpcapng != txpcapng) {
+            p->impl->txpcapng_ifid = txpcapng->add_interface(p->impl->port_name);
+            p->impl->txpcapng = txpcapng;
+        }
+    }
+}
+
 void cea_testbench::stop(cea_port *port) {
     impl->stop(port);
 }
@@ -2509,9 +7237,13 @@ void cea_testbench::pause(cea_port *port) {
 }
 
 void cea_testbench::core::start(cea_port *port) {
+    add_pcapng_interfaces();
     if (port != NULL) {
         vector<cea_port*>::iterator it;
 
+        bootstrap({port});
+        port->impl->open_backend();
+
         // start threads
         for (it = ports.begin(); it != ports.end(); it++) {
             if ((*it)->impl->port_id == port->impl->port_id) {
@@ -2527,6 +7259,10 @@ void cea_testbench::core::start(cea_port *port) {
             }
         }
     } else {
+        bootstrap(ports);
+        for (uint32_t idx=0; idx<ports.size(); idx++) {
+            ports[idx]->impl->open_backend();
+        }
         // start threads
         for (uint32_t idx=0; idx<ports.size(); idx++) {
             ports[idx]->impl->start();
@@ -2538,6 +7274,97 @@ void cea_testbench::core::start(cea_port *port) {
     }
 }
 
+void cea_testbench::core::bootstrap(vector<cea_port*> targets) {
+    uint64_t start = timebase.ticks();
+
+    // a stream added to a port more than once is bootstrapped once
+    vector<cea_stream*> streams;
+    for (auto port : targets) {
+        streams.insert(streams.end(), port->impl->streamq.begin(),
+            port->impl->streamq.end());
+    }
+    sort(streams.begin(), streams.end());
+    streams.erase(unique(streams.begin(), streams.end()), streams.end());
+    if (streams.empty()) {
+        return;
+    }
+
+    // a clone is bootstrapped after the stream it was cloned from so that it
+    // can share its plan. That stream is bootstrapped too if it never was
+    for (size_t idx=0; idx<streams.size(); idx++) {
+        cea_stream *src = streams[idx]->impl->source;
+        if (src && src->impl->boot_headers.empty()) {
+            streams.push_back(src);
+        }
+    }
+    sort(streams.begin(), streams.end());
+    streams.erase(unique(streams.begin(), streams.end()), streams.end());
+    vector<vector<cea_stream*>> levels;
+    for (auto s : streams) {
+        size_t depth = 0;
+        for (auto src = s->impl->source; src; src = src->impl->source) {
+            depth++;
+        }
+        levels.resize(max(levels.size(), depth + 1));
+        levels[depth].push_back(s);
+    }
+
+    uint32_t nof_threads = min((size_t) max(thread::hardware_concurrency(), 1U),
+        streams.size());
+    // run f(idx) for idx 0 to n-1 on the pool, the caller is one of the
+    // threads of the pool
+    auto run_pool = [nof_threads](size_t n, function<void(size_t)> f) {
+        atomic<size_t> next(0);
+        auto task = [&]() {
+            string prefix = cea::msg_prefix;
+            cea::msg_prefix = "bootstrap";
+            for (size_t idx; (idx = next.fetch_add(1)) < n;) {
+                f(idx);
+            }
+            cea::msg_prefix = prefix;
+        };
+        vector<thread> pool;
+        for (uint32_t idx=1; idx<min((size_t) nof_threads, n); idx++) {
+            pool.emplace_back(task);
+        }
+        task();
+        for (auto &t : pool) {
+            t.join();
+        }
+    };
+
+    for (auto &level : levels) {
+        run_pool(level.size(), [&](size_t idx) {
+            level[idx]->impl->bootstrap_stream();
+        });
+    }
+    uint64_t booted = timebase.ticks();
+
+    // the ports prepare their streams in parallel, a stream is on one port
+    run_pool(targets.size(), [&](size_t idx) {
+        targets[idx]->impl->prepare_streams();
+    });
+    uint64_t prepared = timebase.ticks();
+
+    CEA_MSG("Bootstrapped " << streams.size() << " streams on " << nof_threads
+        << " threads in " << timebase.ticks_to_ns(booted - start) / 1000
+        << " us, prepared for " << targets.size() << " ports in "
+        << timebase.ticks_to_ns(prepared - booted) / 1000 << " us");
+    for (uint32_t id=0; id<Num_Boot_Stages; id++) {
+        uint64_t total = 0, worst = 0;
+        for (auto s : streams) {
+            total += s->impl->boot_ticks[id];
+            worst = max(worst, s->impl->boot_ticks[id]);
+        }
+        if (total == 0) continue;
+        char line[96];
+        snprintf(line, sizeof(line), "%-22s total %10.1f us, max %8.1f us",
+            cea_boot_stage_name[id].c_str(), timebase.ticks_to_ns(total) / 1e3,
+            timebase.ticks_to_ns(worst) / 1e3);
+        CEA_DBG(line);
+    }
+}
+
 void cea_testbench::core::stop(cea_port *port) {
     if (port != NULL) {
         vector<cea_port*>::iterator it;
@@ -2552,6 +7379,9 @@ void cea_testbench::core::stop(cea_port *port) {
             ports[idx]->impl->stop();
         }
     }
+#if CEA_TRACE_LEVEL > 0
+    cea_trace_dump("run.trace");
+#endif
 }
 
 void cea_testbench::core::pause(cea_port *port) {
@@ -2569,7 +7399,7 @@ void cea_testbench::core::pause(cea_port *port) {
         }
     }
 }
- 
+
 // UDFI
 //------------------------------------------------------------------------------
 // Udf implementation
@@ -2598,7 +7428,8 @@ void cea_udf::core::set(cea_field_genspec spec) {
 // GSFM //
 #define gsf_is_buf_int(hd)                                      \
     extern "C" int  hd ## _fill   (int,int);                    \
-    extern "C" void hd ## _put    (unsigned *); \
+    extern "C" void hd ## _put    (unsigned *);                 \
+    extern "C" void hd ## _put_burst (unsigned *, int);         \
     extern "C" void hd ## _zyackf (int);                        \
     extern "C" void hd ##  _zyprefetch(int n, int proxy_id){    \
         int eos;                                                \
@@ -2612,49 +7443,218 @@ gsf_is_buf(DataQ)
 extern "C" void DataQ_put (unsigned *) {
 }
 
+// hand over n contiguous interface width elements in one call
+extern "C" void DataQ_put_burst (unsigned *, int) {
+}
+
 extern "C" void DataQ_zyackf (int) {
 }
 
-#define PACKED __attribute__((__packed__))
+// elements received on the port proxy_id, each frame is preceded by an
+// rx_metadata element
+extern "C" void DataQ_receive (unsigned *elems, int n, int proxy_id) {
+    controller.do_receive((unsigned char*)elems, n, controller.ports.get(proxy_id));
+}
 
-struct PACKED tx_metadata {
-    uint64_t tx_disable_crc;
-    uint32_t len : 32;
-    uint8_t is_dummy;
-    char pad_centre[2];
-    uint8_t start_stream_ch : 8;
-    uint32_t ipg : 32;
-    char pad_last[44];
-};
+int cea_controller::do_mutate(int n, cea_port *p) {
+    if (p == nullptr) {
+        CEA_ERR_MSG("Fill requested for a proxy id without a port");
+        abort();
+    }
+    return p->impl->fill(n);
+}
 
-struct PACKED rx_metadata {
-    uint32_t len : 32;
-    uint32_t pad_centre : 32;
-    uint32_t ipg : 32;
-    uint64_t rx_tstamp : 64;
-    char pad_init[64 - 21];
-    uint8_t id;
-};
+void cea_controller::do_receive(unsigned char *elems, int n, cea_port *p) {
+    if (p == nullptr) {
+        CEA_ERR_MSG("Elements received for a proxy id without a port");
+        abort();
+    }
+    p->impl->receive(elems, n);
+}
 
-// Element type identifier
-uint8_t FRAME_ELEM = 0;
-uint8_t META_ELEM = 1;
-uint8_t FRAG_ELEM = 2;
-uint8_t EOS_ELEM  = 4;
+int cea_port::core::fill(uint32_t space) {
+    if (afp) {
+        return fill_af_packet(space);
+    }
+    int eos = 0;
+    unsigned char *staging = txring.base;
+    while (space > 0) {
+        uint32_t chunk = min(space, txring.capacity);
+        if (shm) {
+            // generate straight into the shared ring
+            txring.base = shm->acquire(chunk);
+        }
+        txring.count = 0;
+        if (interleave) {
+            eos = enqueue_interleaved(chunk);
+        } else {
+            eos = 0;
+            while (txring.count < chunk && !eos) {
+                auto s = current_stream->impl.get();
+                if (s->mutate_enqueue(txring, chunk - txring.count)) {
+                    eos = next_pass(s);
+                }
+            }
+        }
+        CEA_TRACE(1, TRACE_Fill, port_id, chunk, txring.count);
+        if (txring.count > 0) {
+            cea_stream_fence();
+            put_burst(txring.base, txring.count);
+        }
+        space -= txring.count;
+        if (eos || txring.count < chunk) break;
+    }
+    txring.base = staging;
+    return eos;
+}
 
-int cea_controller::do_mutate(int n, cea_port *p) {
-    return p->impl->current_stream->impl->mutate_enqueue(n);
+// frames are generated straight into the tx slots of af_packet, one frame
+// per slot. The rest of a frame larger than a slot goes to the staging ring
+// and the frame is dropped
+int cea_port::core::fill_af_packet(uint32_t space) {
+    int eos = 0;
+    uint32_t filled = 0;
+    unsigned char *staging = txring.base;
+    while (filled < space && !eos) {
+        txring.base = afp->frame_elems();
+        txring.count = 0;
+        eos = enqueue_frame(afp->slot_elems);
+        uint32_t n = txring.count;
+        txring.base = staging;
+        while (!eos && mid_frame()) {
+            txring.count = 0;
+            eos = enqueue_frame(txring.capacity);
+            n += txring.count;
+        }
+        if (n == 0) break;
+        // stored through the cache, the release of the slot orders them
+        afp->commit(n);
+        filled += n;
+    }
+    txstats.add(txstats.elements, filled);
+    CEA_TRACE(1, TRACE_Fill, port_id, space, filled);
+    txring.base = staging;
+    return eos;
+}
+
+int cea_port::core::enqueue_frame(uint32_t space) {
+    if (interleave) {
+        return enqueue_interleaved(space, true);
+    }
+    auto s = current_stream->impl.get();
+    return s->mutate_enqueue(txring, space, true) ? next_pass(s) : 0;
+}
+
+bool cea_port::core::mid_frame() {
+    cea_stream::core *s = nullptr;
+    if (interleave) {
+        s = drr_active.empty() ? nullptr : drr[drr_active.front()].stream;
+    } else if (current_stream) {
+        s = current_stream->impl.get();
+    }
+    return s && !s->txdone;
+}
+
+void cea_port::core::put_burst(unsigned char *elems, uint32_t n) {
+    txstats.add(txstats.elements, n);
+    switch (backend) {
+        case Loopback_Backend: {
+            loopback->put_burst(elems, n);
+            break;
+            }
+        case Shm_Backend: {
+            shm->publish(n);
+            break;
+            }
+        default: {
+            DataQ_put_burst((unsigned*)elems, n);
+            break;
+            }
+    }
 }
 
 int DataQ_fill(int n, int proxy_id) {
-    return controller.do_mutate(n, controller.gports[proxy_id]);
+    return controller.do_mutate(n, controller.ports.get(proxy_id));
 }
 
-void cea_stream::core::prepare_for_mutation() {
-    num_txns = ((get_field(stream_properties, STREAM_Burst_Size)).gspec).nmr.value;
-    mut = mutable_fields;
+void cea_stream::core::prepare_for_mutation(uint32_t ifwidth, uint64_t line_rate,
+    bool cached) {
+    packer = cea_get_pack_ops(ifwidth, !cached);
+    this->ifwidth = ifwidth;
+    this->line_rate = line_rate;
+    meta_elems = packer.num_elems(CEA_FRM_METASIZE);
+    size_idx = 0;
+    patch_len = (replay != nullptr);
+    build_rate_schedule();
+
+    traffic_type = (get_field(stream_properties, STREAM_Traffic_Type)).gspec.nmr.value;
+    traffic_control = (get_field(stream_properties, STREAM_Traffic_Control)).gspec.nmr.value;
+    if (traffic_type != Continuous && traffic_type != Bursty) {
+        CEA_ERR_MSG("Traffic type must be Continuous or Bursty");
+        abort();
+    }
+    if (traffic_control != Continuous && traffic_control != Stop_After_Stream
+        && traffic_control != Goto_Next_Stream) {
+        CEA_ERR_MSG("Traffic control must be Continuous, Stop_After_Stream"
+            " or Goto_Next_Stream");
+        abort();
+    }
+    if (traffic_type == Continuous) {
+        num_txns = UINT64_MAX;
+    } else {
+        num_txns = ((get_field(stream_properties, STREAM_Burst_Size)).gspec).nmr.value;
+    }
+    isg = gap_bytes(STREAM_Isg, isg_unit);
+    ibg = gap_bytes(STREAM_Ibg, ibg_unit);
+    memset(&gap_meta, 0, sizeof(tx_metadata));
+    gap_meta.is_dummy = 1;
+    gap_meta.start_stream_ch = stream_id & 0xff;
+
+    mut.clear();
+    mut.reserve(mutable_fields.size());
+    for (auto &m : mutable_fields) {
+        mut.push_back(cea_runtime_copy(m));
+    }
     lenspec = (get_field(stream_properties, FRAME_Len)).gspec;
 
+    // a replayed frame is copied to the principal frame only upto the last
+    // mutable field so that the mutation engine can override it
+    uint32_t ovl_len = 0;
+    for (auto &m : mut) {
+        ovl_len = max(ovl_len, (m.mdata.offset + m.defaults.len + 7) / 8);
+    }
+    sig_offset = hdr_len / 8;
+    if (sig_enable) {
+        ovl_len = max(ovl_len, sig_offset + (uint32_t) sizeof(cea_signature));
+    }
+    replay_head_elems = packer.num_elems(ovl_len);
+
+    // the payload as laid in the principal frame by fill_principal_frame
+    if (sig_enable && !replay) {
+        auto plspec = (get_field(stream_properties, PAYLOAD_Pattern)).gspec;
+        memcpy(sig_cover, (plspec.gen_type == Random)
+            ? arof_rnd_payload_data[0].get() : arof_payload_data.get(),
+            sizeof(sig_cover));
+    }
+    if (sig_dirty) {
+        memcpy(pf + sig_offset, sig_cover, sizeof(sig_cover));
+        sig_dirty = false;
+    }
+
+    start_pass(0);
+}
+
+// convert an inter stream or inter burst gap to bytes at the line rate
+uint32_t cea_stream::core::gap_bytes(cea_field_id id, cea_unit unit) {
+    long double gap = (get_field(stream_properties, id)).gspec.nmr.value;
+    if (unit == Nanosecond) gap = gap * line_rate / 8e9L;
+    if (unit == Millisecond) gap = gap * line_rate / 8e3L;
+    return (uint32_t) min(llroundl(gap), (long long) UINT32_MAX);
+}
+
+// rewind the stream for another pass without bootstrapping it again. A non
+// zero gap is transmitted ahead of the first frame
+void cea_stream::core::start_pass(uint32_t gap) {
     num_txns_transmitted = 0;
     offset = 0;
     txdone = true;
@@ -2662,22 +7662,48 @@ void cea_stream::core::prepare_for_mutation() {
     num_elems_transmitted = 0;
     stream_done = false;
     state = NEW_FRAME;
+    gap_pending = (gap != 0);
+    in_gap = false;
+    gap_meta.ipg = gap;
+}
+
+// the stream will not be transmitted again
+void cea_stream::core::finish() {
+    if (txpcap) {
+        txpcap->close();
+    }
+    if (tbpcap) {
+        tbpcap->close();
+    }
 }
 
-int cea_stream::core::mutate_enqueue(uint32_t space) {
+// generate upto space elements into the ring. With one_frame the call returns
+// as soon as the frame in progress is complete, so that the port can switch to
+// another stream at the frame boundary
+int cea_stream::core::mutate_enqueue(cea_txring &ring, uint32_t space, bool one_frame) {
     if (stream_done) return 1;
 
     uint32_t space_avail = space;
 
     while (space_avail > 0) {
-        cealog << "State: " << ((state==0) ? "NEW FRAME" : "TRANSMIT")  << endl;
+        CEA_TRACE(2, TRACE_State, stream_id, state, 0);
         switch (state) {
             case NEW_FRAME:
-                if (txdone) {
-                    mutate_next_frame();
-                    cealog << "Frame Size: " << lenspec.nmr.value << endl;
-                    num_elems = ceil( (double)(lenspec.nmr.value)/64); // IFWIDTH=64B
-                    cealog << "Num Elems: " << num_elems << endl;
+                if (txdone && gap_pending) {
+                    gap_pending = false;
+                    in_gap = true;
+                    frame_meta = (unsigned char*) &gap_meta;
+                    CEA_TRACE(2, TRACE_Gap, stream_id, gap_meta.ipg, meta_elems);
+                    frame_len = 0;
+                    frame_head_elems = 0;
+                    num_elems = meta_elems;
+                    state = TRANSMIT;
+                    num_elems_transmitted = 0;
+                    txdone = false;
+                } else if (txdone) {
+                    next_frame();
+                    num_elems = meta_elems + packer.num_elems(frame_len);
+                    CEA_TRACE(2, TRACE_New_Frame, stream_id, frame_len, num_elems);
                     state = TRANSMIT;
                     num_elems_transmitted = 0;
                     offset = 0;
@@ -2687,27 +7713,243 @@ int cea_stream::core::mutate_enqueue(uint32_t space) {
                 }
                 break;
 
-            case TRANSMIT:
-                DataQ_put((unsigned int*)pf+offset); // TODO Check
-                num_elems_transmitted++;
-                offset += 64;
-                space_avail--;
-                if (num_elems_transmitted == num_elems) {
-                    cealog << "Transmitting: " << num_elems_transmitted << endl;
+            case TRANSMIT: {
+                // emit as many elements of the metadata and the frame as the
+                // space allows so that they land in consecutive slots
+                uint32_t nelems = min(num_elems - num_elems_transmitted, space_avail);
+                unsigned char *dst = ring.base + (ring.count * ring.width);
+                uint32_t first = num_elems_transmitted;
+                uint32_t last = first + nelems;
+                if (first < meta_elems) {
+                    uint32_t n = min(last, meta_elems) - first;
+                    emit_meta(dst, first, n);
+                    dst += n * ring.width;
+                    first += n;
+                }
+                // frame elements relative to the start of the frame
+                first -= meta_elems;
+                last -= meta_elems;
+                if (first < min(last, frame_head_elems)) {
+                    uint32_t n = min(last, frame_head_elems) - first;
+                    packer.pack(dst, pf, frame_len, first, n);
+                    dst += n * ring.width;
+                    first += n;
+                }
+                if (first < last) {
+                    packer.pack(dst, frame_data, frame_len, first, last - first);
+                }
+                ring.count += nelems;
+                stats.add(stats.elements, nelems);
+                num_elems_transmitted += nelems;
+                offset += nelems * ring.width;
+                space_avail -= nelems;
+                if (num_elems_transmitted == num_elems && in_gap) {
                     txdone = true;
+                    in_gap = false;
+                    state = NEW_FRAME;
+                    if (one_frame) return 0;
+                } else if (num_elems_transmitted == num_elems) {
+                    txdone = true;
+                    stats.add(stats.frames, 1);
+                    stats.add(stats.bytes, frame_len);
                     num_txns_transmitted++;
+                    CEA_TRACE(2, TRACE_Frame_Done, stream_id, num_txns_transmitted,
+                        num_elems_transmitted);
                     if (num_txns_transmitted == num_txns) {
                         stream_done = true;
                         return 1;
                     }
                     state = NEW_FRAME;
+                    if (one_frame) return 0;
                 }
                 break;
+                }
             } //switch
     }
     return 0;
 }
 
+// mutate the next frame and select its metadata template
+void cea_stream::core::next_frame() {
+    if (replay) {
+        replay->next(frame_data, frame_len);
+        frame_len = min(frame_len, (uint32_t)CEA_MAX_FRAME_SIZE);
+        frame_head_elems = min(replay_head_elems, packer.num_elems(frame_len));
+        frame_head_len = min(frame_head_elems * ifwidth, frame_len);
+        if (frame_head_len > 0) {
+            memcpy(pf, frame_data, frame_head_len);
+            mutate_next_frame();
+            if (sig_enable) write_signature();
+        }
+        frame_meta = (unsigned char*) arof_meta_templates;
+        if (patch_ipg) {
+            ipg_acc += (ipg_a == 0) ? vof_ipg_fp[0] : ipg_of(frame_len);
+        }
+    } else {
+        mutate_next_frame();
+        frame_len = vof_frame_sizes[size_idx];
+        frame_data = pf;
+        frame_head_elems = packer.num_elems(frame_len);
+        frame_head_len = frame_len;
+        frame_meta = (unsigned char*)(arof_meta_templates
+            + vof_meta_template_idx[size_idx]);
+        if (sig_enable) write_signature();
+        if (patch_ipg) {
+            ipg_acc += vof_ipg_fp[vof_meta_template_idx[size_idx]];
+        }
+        size_idx = (size_idx+1 == nof_sizes) ? 0 : size_idx+1;
+    }
+    if (patch_ipg) {
+        frame_ipg = ipg_acc >> 32;
+        ipg_acc &= 0xffffffff;
+    }
+    if (txpcap && !txpcap->write(pf, frame_head_len,
+        frame_data + frame_head_len, frame_len - frame_head_len)) {
+        stats.add(stats.pcap_drops, 1);
+    }
+    if (tbpcap && !tbpcap->write(pf, frame_head_len,
+        frame_data + frame_head_len, frame_len - frame_head_len)) {
+        stats.add(stats.pcap_drops, 1);
+    }
+}
+
+// stamp the frame with the stream id, its sequence number and the time. A
+// frame too short to hold the signature before its fcs goes unsigned
+void cea_stream::core::write_signature() {
+    // the same bound as the analyzer, which does not look into the FCS
+    uint32_t fcs_len = replay ? 0 : CEA_FCS_LEN;
+    if (sig_offset + sizeof(cea_signature) + fcs_len > frame_len) {
+        // no signature of an earlier frame is left behind, a replayed frame
+        // overwrites the principal frame anyway
+        if (sig_dirty) {
+            memcpy(pf + sig_offset, sig_cover, sizeof(sig_cover));
+            sig_dirty = false;
+        }
+        return;
+    }
+    cea_signature sig;
+    sig.magic = CEA_SIGNATURE_MAGIC;
+    sig.stream_id = stream_id;
+    sig.seq = sig_seq++;
+    sig.tstamp = timebase.ticks();
+    memcpy(pf + sig_offset, &sig, sizeof(cea_signature));
+    sig_dirty = !replay;
+}
+
+// derive the ipg coefficients from the bandwidth or the ipg of the stream and
+// compute the ipg of every metadata template
+void cea_stream::core::build_rate_schedule() {
+    long double line_bytes = line_rate / 8.0L;  // bytes per second
+    long double overhead = CEA_PREAMBLE_LEN;
+
+    if (rate_from_bandwidth) {
+        long double bw = (get_field(stream_properties, STREAM_Bandwidth)).gspec.nmr.value;
+        switch (bw_unit) {
+            case Percent: { // the frame with preamble and min ipg gets bw% of the line
+                ipg_a = 100.0L / bw - 1;
+                ipg_b = (CEA_PREAMBLE_LEN + CEA_MIN_IPG) * 100.0L / bw - overhead;
+                break;
+                }
+            case Frames_Per_Sec: {
+                ipg_a = -1;
+                ipg_b = line_bytes / bw - overhead;
+                break;
+                }
+            default: { // frame bits per second
+                if (bw_unit == Kilobits_Per_Sec) bw *= 1e3L;
+                if (bw_unit == Megabits_Per_Sec) bw *= 1e6L;
+                ipg_a = line_rate / bw - 1;
+                ipg_b = -overhead;
+                break;
+                }
+        }
+    } else {
+        long double ipg = (get_field(stream_properties, STREAM_Ipg)).gspec.nmr.value;
+        if (ipg_unit == Nanosecond) ipg = ipg * line_bytes / 1e9L;
+        if (ipg_unit == Millisecond) ipg = ipg * line_bytes / 1e3L;
+        ipg_a = 0;
+        ipg_b = ipg;
+    }
+    clamp_min_ipg = rate_from_bandwidth;
+    apply_rate_schedule();
+}
+
+// the templates carry the ipg of their frame size. The ipg is patched per
+// frame only when it has a fraction or when replayed frames vary in size
+void cea_stream::core::apply_rate_schedule() {
+    ipg_clamped = false;
+    bool fractional = false;
+    vof_ipg_fp.resize(nof_meta_templates);
+    for (uint32_t idx=0; idx<nof_meta_templates; idx++) {
+        uint64_t fp = ipg_of(arof_meta_templates[idx].len);
+        vof_ipg_fp[idx] = fp;
+        arof_meta_templates[idx].ipg = fp >> 32;
+        fractional |= ((fp & 0xffffffff) != 0);
+    }
+    patch_ipg = fractional || (replay != nullptr && ipg_a != 0);
+    ipg_acc = 0;
+
+    if (ipg_clamped) {
+        CEA_MSG("Requested rate is outside the range of the line, ipg is clamped");
+    }
+}
+
+long double cea_stream::core::line_share() {
+    long double used = 0;
+    long double total = 0;
+    for (uint32_t idx=0; idx<nof_sizes; idx++) {
+        uint32_t len = vof_frame_sizes[idx];
+        used += len + CEA_PREAMBLE_LEN + CEA_MIN_IPG;
+        total += len + CEA_PREAMBLE_LEN + ipg_of(len) / 4294967296.0L;
+    }
+    return used / total;
+}
+
+// when the streams of a port together take total of the line, every byte
+// transmitted must be followed by a gap so that the line is used only to that
+// extent. The share of each stream is enforced by the port scheduler
+void cea_stream::core::set_port_share(long double total) {
+    ipg_a = 1 / total - 1;
+    ipg_b = (CEA_PREAMBLE_LEN + CEA_MIN_IPG) / total - CEA_PREAMBLE_LEN;
+    clamp_min_ipg = true;
+    apply_rate_schedule();
+}
+
+// ipg in bytes of a frame of length len in 32.32 fixed point
+uint64_t cea_stream::core::ipg_of(uint32_t len) {
+    long double ipg = ipg_a * len + ipg_b;
+    if (clamp_min_ipg && ipg < CEA_MIN_IPG) {
+        ipg = CEA_MIN_IPG;
+        ipg_clamped = true;
+    }
+    if (ipg > UINT32_MAX) {
+        ipg = UINT32_MAX;
+        ipg_clamped = true;
+    }
+    return (uint64_t) llroundl(ipg * 4294967296.0L);
+}
+
+// copy n elements of the metadata template of the current frame starting from
+// element first. The template is copied with regular stores so that the ipg
+// can be patched with a single store while the line is still in the cache
+void cea_stream::core::emit_meta(unsigned char *dst, uint32_t first, uint32_t n) {
+    uint32_t begin = first * ifwidth;
+    uint32_t end = begin + (n * ifwidth);
+    if (ifwidth <= CEA_FRM_METASIZE) {
+        memcpy(dst, frame_meta + begin, n * ifwidth);
+    } else {
+        memcpy(dst, frame_meta, CEA_FRM_METASIZE);
+        memset(dst + CEA_FRM_METASIZE, 0, ifwidth - CEA_FRM_METASIZE);
+    }
+    if (in_gap) return;
+    if (patch_ipg && CEA_META_IPG_OFFSET >= begin && CEA_META_IPG_OFFSET < end) {
+        *(uint32_t*)(dst + CEA_META_IPG_OFFSET - begin) = frame_ipg;
+    }
+    if (patch_len && CEA_META_LEN_OFFSET >= begin && CEA_META_LEN_OFFSET < end) {
+        *(uint32_t*)(dst + CEA_META_LEN_OFFSET - begin) = frame_len;
+    }
+}
+
 void cea_stream::core::mutate_next_frame() {
     for (auto m=begin(mut); m!=end(mut); m++) {
         switch(m->defaults.type) {
@@ -2719,8 +7961,8 @@ void cea_stream::core::mutate_next_frame() {
                         break;
                         }
                     case Value_List: { // TESTED
-                        cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns[m->rt.idx], m->defaults.len/8);
-                        if (m->rt.idx < m->rt.patterns.size()-1) {
+                        cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns.get()[m->rt.idx], m->defaults.len/8);
+                        if (m->rt.idx < m->rt.nof_patterns-1) {
                             m->rt.idx++;
                         } else {
                             if (m->gspec.nmr.repeat) {
@@ -2785,8 +8027,8 @@ void cea_stream::core::mutate_next_frame() {
                         break;
                         }
                     case Value_List: {
-                        cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns[m->rt.idx], m->defaults.len/8);
-                        if (m->rt.idx < m->rt.patterns.size()-1) {
+                        cea_memcpy_ntw_byte_order(pf+m->mdata.offset/8, (char*)&m->rt.patterns.get()[m->rt.idx], m->defaults.len/8);
+                        if (m->rt.idx < m->rt.nof_patterns-1) {
                             m->rt.idx++;
                         } else {
                             if (m->gspec.nmr.repeat) {
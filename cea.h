@@ -8,9 +8,12 @@ using namespace std;
 
 namespace cea {
 
+// collects the lines written to cealog by a thread and queues them to the
+// logger of the library
 class outbuf : public streambuf {
 protected:
     virtual int overflow(int c);
+    virtual streamsize xsputn(const char *s, streamsize n);
 } ob;
 
 ostream cealog(&ob);
@@ -145,7 +148,30 @@ enum cea_field_id {
 
 enum cea_stream_feature_id {
     PCAP_Record_Tx_Enable,
-    PCAP_Record_Rx_Enable
+    PCAP_Record_Rx_Enable,      // on a stream, records the port it is added to
+    PCAPNG_Record_Tx_Enable,    // testbench only, all ports into one file
+    PCAP_Comment,               // comment added to every recorded frame
+    PCAP_Replay_Source,         // pcap or pcapng file replayed by the stream
+    Signature_Enable,           // test signature after the headers of a frame
+    Rx_Analyzer_Enable,         // port only, loss and latency of the signatures
+    Plan_Cache_Dir              // directory of the compiled plans of the stream
+};
+
+enum cea_port_property_id {
+    PORT_Interface_Width,   // 16, 32, 64, 128, 256 or 512 bytes
+    PORT_Line_Rate,         // line rate in Mbps, used by the rate engine
+    PORT_Interleave,        // 1 to interleave all streams by bandwidth share
+    PORT_Backend,           // consumer of the generated elements
+    PORT_Loopback_Paced,    // 0 to drain the loopback as fast as possible
+    PORT_Interface_Name,    // linux interface used by the AF_PACKET backend
+    PORT_Socket_Path        // unix socket the Shm_Backend consumer connects to
+};
+
+enum cea_port_backend {
+    Gsfm_Backend,           // elements are requested by the hardware emulator
+    Loopback_Backend,       // elements are looped back to the rx of the port
+    AF_Packet_Backend,      // frames are sent and received on a linux interface
+    Shm_Backend             // elements are shared with an external consumer
 };
 
 enum cea_unit {
@@ -209,6 +235,25 @@ struct cea_field_genspec {
     } str;
 };
 
+// Control block at the start of the shared memory of a port that uses the
+// Shm_Backend. The generator writes elements at tail and then advances tail,
+// the consumer reads elements at head and then advances head. Both are free
+// running element counts, the element of a count is at
+// data_offset + (count & (capacity - 1)) * width. Updates must be made with
+// release semantics and read with acquire semantics
+#define CEA_SHM_MAGIC 0x314d48535f414543ULL // "CEA_SHM1"
+
+struct cea_shm_ctrl {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t width;         // element size in bytes
+    uint64_t capacity;      // number of elements, a power of 2
+    uint64_t data_offset;   // bytes from the control block to the elements
+    alignas(64) uint64_t tail;
+    alignas(64) uint64_t head;
+    alignas(64) uint32_t eos; // set by the generator after the last element
+};
+
 // forward declaration
 class cea_stream;
 class cea_port;
@@ -217,6 +262,66 @@ class cea_header;
 class cea_field;
 class cea_udf;
 
+//------------------------------------------------------------------------------
+// Statistics
+//------------------------------------------------------------------------------
+
+// Counters of a stream or of one direction of a port. The rates are taken
+// over the interval since the previous snapshot
+struct cea_counters {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t elements;
+    uint64_t stalls;        // waits of the generator for its consumer
+    uint64_t rate_waits;    // waits for the emulated line to catch up
+    uint64_t pcap_drops;    // frames the pcap writers could not keep up with
+    uint64_t errors;        // rx elements dropped while framing
+    double pps;
+    double bps;
+};
+
+// Log-linear histogram of latencies in ns. Values below 128 have their own
+// bucket, above that every power of two is split in 64 linear sub buckets so
+// a value is known within 1/64 of itself. Values from 2^40 ns (18 minutes)
+// on share the last bucket
+#define CEA_HIST_SUB_BITS 6
+#define CEA_HIST_MAX_EXP 40
+#define CEA_HIST_BUCKETS ((CEA_HIST_MAX_EXP - CEA_HIST_SUB_BITS + 1) << CEA_HIST_SUB_BITS)
+
+struct cea_histogram {
+    vector<uint64_t> counts;    // CEA_HIST_BUCKETS, empty when nothing recorded
+    uint64_t total;
+    uint64_t max;
+
+    // add the values of another histogram, such as the same stream on
+    // another port
+    void merge(const cea_histogram &other);
+
+    // smallest value that p percent of the values do not exceed
+    uint64_t percentile(double p) const;
+};
+
+struct cea_stream_stats {
+    uint32_t id;
+    string name;
+    cea_counters tx;
+    cea_histogram latency;      // merged over the ports that analyze the stream
+};
+
+struct cea_port_stats {
+    uint32_t id;
+    string name;
+    cea_counters tx;
+    cea_counters rx;
+};
+
+struct cea_stats {
+    uint64_t tstamp_ns;     // unix time of the snapshot
+    double interval;        // seconds since the previous snapshot
+    vector<cea_port_stats> ports;
+    vector<cea_stream_stats> streams;
+};
+
 //------------------------------------------------------------------------------
 // Top level software class (sw testbench)
 //------------------------------------------------------------------------------
@@ -226,12 +331,36 @@ public:
     cea_testbench(); // TODO add socket port number for external interfacing
     ~cea_testbench();
     void add_port(cea_port *port);
+    // without a port the stream is added to the first port and a clone of it
+    // to each of the other ports
     void add_stream(cea_stream *stream, cea_port *port = NULL);
     void add_cmd(cea_stream *stream, cea_port *port = NULL);
     void exec_cmd(cea_stream *stream, cea_port *port = NULL);
     void start(cea_port *port = NULL);
     void stop(cea_port *port = NULL);
     void pause(cea_port *port = NULL);
+    void set(cea_stream_feature_id feature, bool mode);
+    // counters of all ports and streams, never blocks the generation. Call
+    // from one thread at a time, the rates are relative to the previous call
+    cea_stats snapshot();
+    // build the ports and streams described by a JSON spec file and add them
+    // to the testbench. The file is an object of testbench features and
+    // "ports", an object of ports by name. A port is an object of port
+    // properties, features and "streams", an object of streams by name. A
+    // stream is an object of stream properties, features and "headers", an
+    // array of objects that map a header type to its fields:
+    //
+    // {"ports": {"p0": {"PORT_Backend": "Loopback_Backend",
+    //   "streams": {"s0": {"FRAME_Len": 128, "STREAM_Traffic_Type": "Bursty",
+    //     "STREAM_Bandwidth": {"value": 50, "unit": "Percent"},
+    //     "headers": [{"MAC": {"MAC_Ether_Type": "0x0800"}},
+    //       {"IPv4": {"IPv4_Src_Addr": "10.0.0.1",
+    //         "IPv4_Id": {"gen_type": "Increment", "start": 0, "step": 1,
+    //           "count": 100, "repeat": true}}}]}}}}}
+    //
+    // A field is a number, a string or a generation spec with the members of
+    // cea_field_genspec. Strings of the form "0x..." are hex integers
+    void load(string fname);
 private:
     class core;
     unique_ptr<core> impl;
@@ -246,9 +375,14 @@ class cea_port {
 public:
     cea_port(string name = "port");
     ~cea_port();
+    // a stream runs on one port, add a clone of it to run it on another
     void add_stream(cea_stream *stream);
     void add_cmd(cea_stream *stream);
     void exec_cmd(cea_stream *stream);
+    void set(cea_port_property_id id, uint64_t value);
+    void set(cea_port_property_id id, string value);
+    void set(cea_port_property_id id, const char *value);
+    void set(cea_stream_feature_id feature, bool mode);
 private:
     class core;
     unique_ptr<core> impl;
@@ -264,11 +398,24 @@ class cea_stream {
 public:    
     cea_stream(string name = "stream");
     ~cea_stream();
-    void set(cea_field_id id, uint64_t value); // to set property only
-    void set(cea_field_id id, cea_field_genspec spec); // to set property only
+    // a property, or a field of the first header added to the stream that
+    // has the field. A header field is set for this stream only, the header
+    // is left as it is and can be shared with other streams
+    void set(cea_field_id id, uint64_t value);
+    void set(cea_field_id id, string value); // header fields only
+    void set(cea_field_id id, cea_field_genspec spec);
+    void set(cea_field_id id, uint64_t value, cea_unit unit); // rate properties
     void set(cea_stream_feature_id feature, bool mode);
+    void set(cea_stream_feature_id feature, string value);
+    void set(cea_stream_feature_id feature, const char *value);
     void add_header(cea_header *header);
     void add_udf(cea_field *field);
+    // a new stream with the headers, properties and features of this one,
+    // except for pcap recording and replay. Fields set on the clone apply to
+    // the clone only. When the clone differs from this stream only in fields
+    // of the headers it shares the frame layout, the payload and the value
+    // lists built for this stream instead of building its own
+    cea_stream *clone(string name);
     // TODO Support AVIP type test case
     // TODO Support AVIP type custom payload
     //
@@ -279,7 +426,11 @@ private:
     class core;
     unique_ptr<core> impl;
     friend class cea_port;
+    friend class cea_testbench;
     friend class cea_controller;
+#ifdef CEA_BENCH
+    friend class cea_bench;
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,133 @@
+// Behavioural check of the single pass parsers, built and run by 'make check'.
+// Every input of a fixed set is given to a parser and to the regex the input
+// validation used before it, followed by the conversion that went with the
+// regex. The check fails on any difference in acceptance or in value. The
+// regexes accept only the uncompressed IPv6 notation, the compressed and the
+// dotted quad forms are checked against inet_pton instead
+
+#include "cea.cpp"
+#include <regex>
+#include <arpa/inet.h>
+
+using namespace cea;
+
+static regex regex_mac("([[:xdigit:]]{2}[:]?){5}[[:xdigit:]]{2}");
+static regex regex_ipv4("^(?:(?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9])[.]){3}(?:25[0-5]|2[0-4][0-9]|1[0-9][0-9]|[1-9]?[0-9])$");
+static regex regex_ipv6("((([0-9a-fA-F]){1,4})[:]){7}([0-9a-fA-F]){1,4}");
+// regex_pre of the preamble widened to the lengths of a hex number
+static regex regex_hex("[[:xdigit:]]{1,16}");
+
+static uint32_t nof_inputs = 0;
+static uint32_t nof_mismatches = 0;
+
+static void expect(const char *type, const string &input, bool ok, bool ref_ok,
+    const string &value, const string &ref_value) {
+    nof_inputs++;
+    if (ok == ref_ok && (!ok || value == ref_value)) return;
+    nof_mismatches++;
+    printf("MISMATCH %s '%s': parser %s %s, reference %s %s\n", type,
+        input.c_str(), ok ? "accepts" : "rejects", ok ? value.c_str() : "",
+        ref_ok ? "accepts" : "rejects", ref_ok ? ref_value.c_str() : "");
+}
+
+static string hex_of(uint64_t value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lx", value);
+    return buf;
+}
+
+static string hex_of(const unsigned char *bytes, uint32_t len) {
+    string s;
+    for (uint32_t idx = 0; idx < len; idx++) {
+        char buf[4];
+        snprintf(buf, sizeof(buf), "%02x", bytes[idx]);
+        s += buf;
+    }
+    return s;
+}
+
+static void check_mac(const string &s) {
+    uint64_t mac = 0, ref = 0;
+    bool ok = cea_parse_mac(s, mac);
+    bool ref_ok = regex_match(s, regex_mac);
+    if (ref_ok) {
+        string tmp = s;
+        tmp.erase(remove(tmp.begin(), tmp.end(), ':'), tmp.end());
+        ref = stoul(tmp, 0, 16);
+    }
+    expect("MAC", s, ok, ref_ok, hex_of(mac), hex_of(ref));
+}
+
+static void check_ipv4(const string &s) {
+    uint32_t addr = 0, ref = 0;
+    bool ok = cea_parse_ipv4(s, addr);
+    bool ref_ok = regex_match(s, regex_ipv4);
+    if (ref_ok) {
+        stringstream check(s);
+        string octet;
+        while (getline(check, octet, '.')) {
+            ref = (ref << 8) | stoul(octet);
+        }
+    }
+    expect("IPv4", s, ok, ref_ok, hex_of(addr), hex_of(ref));
+}
+
+static void check_ipv6(const string &s) {
+    unsigned char addr[16] = {}, ref[16] = {};
+    bool ok = cea_parse_ipv6(s, addr);
+    bool pton_ok = (inet_pton(AF_INET6, s.c_str(), ref) == 1);
+    bool ref_ok = regex_match(s, regex_ipv6);
+    if (ref_ok && !pton_ok) {
+        printf("MISMATCH IPv6 '%s': the regex accepts what inet_pton rejects\n",
+            s.c_str());
+        nof_mismatches++;
+    }
+    if (s.find("::") != string::npos || s.find('.') != string::npos) {
+        ref_ok = pton_ok;
+    }
+    expect("IPv6", s, ok, ref_ok, hex_of(addr, 16), hex_of(ref, 16));
+}
+
+static void check_hex(const string &s) {
+    uint64_t value = 0, ref = 0;
+    bool ok = cea_parse_hex(s, value);
+    bool ref_ok = regex_match(s, regex_hex);
+    if (ref_ok) {
+        ref = stoull(s, 0, 16);
+    }
+    expect("hex", s, ok, ref_ok, hex_of(value), hex_of(ref));
+}
+
+int main() {
+    for (auto s : {"00:01:02:03:04:05", "AA:BB:CC:DD:EE:FF", "aabbccddeeff",
+        "aa:bbcc:dd:ee:ff", "0a:0B:0c:0D:0e:0F", "aa:bb:cc:dd:ee:ff:",
+        ":aa:bb:cc:dd:ee:ff", "aa::bb:cc:dd:ee:ff", "aa:bb:cc:dd:ee:fg",
+        "aa:bb:cc:dd:ee:ff00", "aa:bb:cc:dd:ee:ff ", "aa:bb:cc:dd:ee",
+        "a:bb:cc:dd:ee:ff", "aa-bb-cc-dd-ee-ff", ""}) {
+        check_mac(s);
+    }
+    for (auto s : {"0.0.0.0", "255.255.255.255", "10.0.0.1", "192.168.1.100",
+        "01.2.3.4", "192.168.001.1", "1.2.3.00", "256.1.1.1", "1.2.3.300",
+        "1.2.3.999", "1234.1.1.1", "1.2.3", "1.2.3.4.5", "1..2.3", "1.2.3.",
+        "1.2.3.4x", "1.2.3.4 ", " 1.2.3.4", "1.2.3.-4", "a.b.c.d", ""}) {
+        check_ipv4(s);
+    }
+    for (auto s : {"2001:db8:0:0:0:0:0:1", "2001:DB8:A:B:C:D:E:F",
+        "0000:0000:0000:0000:0000:0000:0000:0001", "00000:0:0:0:0:0:0:1",
+        "2001:db8:0:0:0:0:0:10000", "2001:db8::1", "::1", "::", "fe80::",
+        "fe80::1:2", "1:2:3:4:5:6:7::", "::1:2:3:4:5:6:7:8", "1::2::3",
+        "2001:db8::1::", "2001:db8:0:0:0:0:0:1:2", "1:2:3:4:5:6:7",
+        "1:2:3:4:5:6:7:8:", ":1:2:3:4:5:6:7:8", "2001:db8:0:0:0:0:0:1x",
+        "2001:db8:0:0:0:0:0:g", "2001:db8:0:0:0:0:0:1 ", "::ffff:192.168.1.1",
+        "1:2:3:4:5:6:10.0.0.1", "::ffff:192.168.1.256", "::ffff:192.168.001.1",
+        "1:2:3:4:5:6:7:1.2.3.4", "::1.2.3", ":", ""}) {
+        check_ipv6(s);
+    }
+    for (auto s : {"0", "ff", "FF", "DeadBeef", "0123456789abcdef",
+        "ffffffffffffffff", "00000000000000001", "0x12", "12 ", " 12", "xyz",
+        "12g", ""}) {
+        check_hex(s);
+    }
+    printf("%u inputs, %u mismatches\n", nof_inputs, nof_mismatches);
+    return nof_mismatches ? 1 : 0;
+}